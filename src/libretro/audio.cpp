@@ -0,0 +1,630 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include "audio.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MELONDS_DS_AUDIO_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MELONDS_DS_AUDIO_NEON
+#include <arm_neon.h>
+#endif
+
+#include <file/file_path.h>
+#include <libretro.h>
+#include <NDS.h>
+#include <retro_miscellaneous.h>
+#include <SPU.h>
+#include <streams/file_stream.h>
+
+#include "environment.hpp"
+#include "tracy.hpp"
+
+namespace melonds::audio {
+    // 4096 frames is about 125ms of audio, far more than we should ever need to hold
+    constexpr size_t RING_CAPACITY = 4096;
+
+    // The number of SPU frames produced per emulated frame
+    constexpr double INPUT_FRAMES_PER_RUN = SAMPLE_RATE / FPS;
+
+    // The frames the ring keeps on hand beyond one frame's worth, to absorb jitter
+    constexpr double CUSHION = 256;
+
+    // How full the ring should be right after each frame's SPU output is added to it
+    // (not counting the filter's history).
+    // One frame's worth will be consumed right away, leaving the cushion.
+    constexpr double TARGET_FILL = INPUT_FRAMES_PER_RUN + CUSHION;
+
+    // Polyphase filter used when the output rate differs from the SPU's.
+    // 256 phases is fine enough that interpolating between them would be inaudible,
+    // and 16 taps is four SIMD multiplies per channel per output frame.
+    constexpr size_t FILTER_PHASES = 256;
+    constexpr size_t FILTER_TAPS = 16;
+
+    // The filter needs this many frames before the current position
+    constexpr size_t FILTER_HISTORY = FILTER_TAPS / 2 - 1;
+
+    // Keeps the passband just under the output's Nyquist frequency
+    // so that the transition band doesn't alias back into it.
+    constexpr double FILTER_CUTOFF = 0.91;
+
+    // The most that the resampling ratio may deviate from 1.
+    // Half a percent is well below what most listeners can perceive as a pitch change.
+    constexpr double MAX_RATIO_DEVIATION = 0.005;
+
+    static AudioRing<RING_CAPACITY> _ring;
+
+    // Scratch space for SPU::ReadOutput and for the resampled output
+    static std::array<int16_t, 2048 * 2> _spuBuffer;
+    static std::array<int16_t, 2048 * 2> _outputBuffer;
+
+    // Fractional read position into the ring, in input frames
+    static double _position = 0;
+
+    // Fractional number of output frames owed to the frontend
+    static double _outputRemainder = 0;
+
+    // False until the ring first reaches its target fill, and again after each underrun.
+    // Until then we submit silence, rather than trickling out audio that's sure to underrun again.
+    static bool _primed = false;
+
+    // The sample rate reported to the frontend, and the number of output frames it expects per emulated frame
+    static unsigned _outputRate = static_cast<unsigned>(SAMPLE_RATE);
+    static double _outputFramesPerRun = INPUT_FRAMES_PER_RUN;
+
+    // How many already-played frames to keep in the ring for the resampling filter;
+    // 0 when the output rate matches the SPU's and we just interpolate linearly.
+    static size_t _history = 0;
+
+    // One row of FILTER_TAPS coefficients for each phase, plus one more so that a position
+    // that rounds up to the next input frame doesn't need special handling
+    struct alignas(16) FilterPhase {
+        std::array<float, FILTER_TAPS> Taps;
+    };
+    static std::array<FilterPhase, FILTER_PHASES + 1> _filter;
+
+    // The ring's contents converted to planar floats, so that the filter can use SIMD loads
+    static std::array<float, RING_CAPACITY> _left;
+    static std::array<float, RING_CAPACITY> _right;
+
+    // How many frames at the end of the ring are silent.
+    // When that's all of them (e.g. in menus or loading screens), there's no need to resample anything.
+    static size_t _silentFrames = 0;
+    static bool _skipSilence = true;
+    static size_t _skippedFrames = 0;
+
+    static double _ratio = 1.0;
+    static unsigned _underruns = 0;
+    static unsigned _overruns = 0;
+
+    // Frontend buffer feedback, used when a target latency is set.
+    // The frontend aims for this occupancy (in percent) of its own buffer.
+    constexpr unsigned TARGET_FRONTEND_OCCUPANCY = 50;
+
+    // Frontend feedback may borrow frames from the ring's cushion, but never so many that less than this would remain;
+    // otherwise the next bit of jitter would underrun the ring, which is the dropout that feedback is meant to prevent.
+    constexpr double MIN_FEEDBACK_CUSHION = CUSHION / 2;
+
+    constexpr const char* const CAPTURE_FILE_NAME = "melonDS DS audio capture.bin";
+    constexpr uint32_t CAPTURE_VERSION = 1;
+    static bool _captureEnabled = false;
+    static RFILE* _captureFile = nullptr;
+
+    static unsigned _targetLatency = 0;
+    static unsigned _appliedLatency = 0;
+    static bool _bufferStatusAvailable = false;
+    static std::atomic_bool _frontendAudioActive = false;
+    static std::atomic_uint _frontendOccupancy = TARGET_FRONTEND_OCCUPANCY;
+    static std::atomic_bool _frontendUnderrunLikely = false;
+
+    static void ApplyTargetLatency() noexcept;
+    static void BufferStatusCallback(bool active, unsigned occupancy, bool underrun_likely) noexcept;
+    static size_t AdjustSubmission(size_t outputFrames, double fill) noexcept;
+    static void DrainSpu() noexcept;
+    static void OpenCapture() noexcept;
+    static void CloseCapture() noexcept;
+    static void Capture(const int16_t* frames, size_t count) noexcept;
+    static void BuildFilter() noexcept;
+    static void Deinterleave(const int16_t* frames, size_t count, float* left, float* right) noexcept;
+    static float DotProduct(const float* samples, const float* taps) noexcept;
+    static size_t Resample(int16_t* output, size_t outputFrames, double ratio) noexcept;
+    static size_t ResampleSilence(int16_t* output, size_t outputFrames, double ratio) noexcept;
+    static size_t ResampleLinear(int16_t* output, size_t outputFrames, double ratio) noexcept;
+    static size_t ResampleSinc(int16_t* output, size_t outputFrames, double ratio) noexcept;
+}
+
+void melonds::audio::Render() noexcept {
+    ZoneScopedN("melonds::audio::Render");
+
+    if (_targetLatency != _appliedLatency) {
+        ApplyTargetLatency();
+    }
+
+    DrainSpu();
+
+    // The reported sample rate doesn't divide evenly into frames,
+    // so carry the remainder over to the next frame.
+    _outputRemainder += _outputFramesPerRun;
+    size_t outputFrames = std::min(static_cast<size_t>(_outputRemainder), _outputBuffer.size() / 2);
+    _outputRemainder -= outputFrames;
+
+    // Dynamic rate control: if the ring is filling up, consume input slightly faster than we produce output,
+    // and vice versa. This absorbs the drift between the SPU clock and the reported sample rate.
+    double fill = static_cast<double>(_ring.Size() - std::min(_ring.Size(), _history));
+    double error = std::clamp((fill - TARGET_FILL) / TARGET_FILL, -1.0, 1.0);
+    _ratio = (SAMPLE_RATE / _outputRate) * (1.0 + MAX_RATIO_DEVIATION * error);
+
+    if (!_primed && fill >= TARGET_FILL) {
+        _primed = true;
+    }
+
+    if (_primed) {
+        outputFrames = AdjustSubmission(outputFrames, fill);
+    }
+
+    size_t produced = _primed ? Resample(_outputBuffer.data(), outputFrames, _ratio) : 0;
+    if (produced < outputFrames) {
+        // If the ring ran dry before we had a full frame of audio (or we're still filling it)...
+        // Pad with silence so that the frontend's buffer doesn't drain too.
+        if (_primed) {
+            _underruns++;
+            _primed = false;
+        }
+        std::fill(_outputBuffer.begin() + produced * 2, _outputBuffer.begin() + outputFrames * 2, 0);
+    }
+
+    TracyPlot("Audio Ring Fill", static_cast<int64_t>(_ring.Size()));
+    TracyPlot("Audio Resampling Ratio", _ratio);
+    TracyPlot("Audio Underruns", static_cast<int64_t>(_underruns));
+
+    retro::audio_sample_batch(_outputBuffer.data(), outputFrames);
+}
+
+void melonds::audio::Reset() noexcept {
+    _ring.Clear();
+    CloseCapture();
+
+    // Start with silence in the filter's history, so that the first output frame can use it
+    constexpr std::array<int16_t, FILTER_HISTORY * 2> silence {};
+    _ring.Write(silence.data(), _history);
+    _silentFrames = _history;
+    _position = static_cast<double>(_history);
+    _outputRemainder = 0;
+    _primed = false;
+    _ratio = 1.0;
+    _underruns = 0;
+    _overruns = 0;
+    _skippedFrames = 0;
+
+    // The frontend's buffer feedback was about the audio we just threw away
+    if (_bufferStatusAvailable) {
+        retro::environment(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, nullptr);
+        _bufferStatusAvailable = false;
+    }
+    _frontendAudioActive = false;
+    _frontendOccupancy = TARGET_FRONTEND_OCCUPANCY;
+    _frontendUnderrunLikely = false;
+
+    // Apply the target latency again on the next frame, in case the frontend forgot it (e.g. after unloading the game)
+    _appliedLatency = 0;
+}
+
+void melonds::audio::SetOutputSampleRate(unsigned rate) noexcept {
+    ZoneScopedN("melonds::audio::SetOutputSampleRate");
+    if (rate == 0) {
+        rate = static_cast<unsigned>(SAMPLE_RATE);
+    }
+
+    _outputRate = rate;
+    _outputFramesPerRun = rate / FPS;
+    if (rate == static_cast<unsigned>(SAMPLE_RATE)) {
+        _history = 0;
+        retro::info("Submitting audio at the SPU's native rate of %uHz", rate);
+    } else {
+        _history = FILTER_HISTORY;
+        BuildFilter();
+        retro::info("Resampling audio to %uHz in-core", rate);
+    }
+
+    Reset();
+}
+
+unsigned melonds::audio::OutputSampleRate() noexcept {
+    return _outputRate;
+}
+
+void melonds::audio::SetCaptureEnabled(bool enabled) noexcept {
+    _captureEnabled = enabled;
+    if (!enabled) {
+        CloseCapture();
+    }
+}
+
+void melonds::audio::SetSilenceSkipping(bool enabled) noexcept {
+    _skipSilence = enabled;
+}
+
+void melonds::audio::SetTargetLatency(unsigned latency) noexcept {
+    _targetLatency = latency;
+}
+
+melonds::audio::AudioMetrics melonds::audio::Metrics() noexcept {
+    return {
+        .RingFill = _ring.Size(),
+        .RingCapacity = _ring.Capacity(),
+        .Underruns = _underruns,
+        .Overruns = _overruns,
+        .Ratio = _ratio,
+        .SkippedFrames = _skippedFrames,
+    };
+}
+
+static void melonds::audio::ApplyTargetLatency() noexcept {
+    ZoneScopedN("melonds::audio::ApplyTargetLatency");
+    if (_targetLatency > 0) {
+        retro_audio_buffer_status_callback callback { BufferStatusCallback };
+        _bufferStatusAvailable = retro::environment(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, &callback);
+        if (!_bufferStatusAvailable) {
+            retro::warn("Frontend doesn't report its audio buffer status; low-latency audio won't adapt to it");
+        }
+    } else if (_bufferStatusAvailable) {
+        // If we're turning off low-latency audio...
+        retro::environment(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, nullptr);
+        _bufferStatusAvailable = false;
+    }
+
+    unsigned latency = _targetLatency;
+    if (retro::environment(RETRO_ENVIRONMENT_SET_MINIMUM_AUDIO_LATENCY, &latency)) {
+        retro::debug("Set minimum frontend audio latency to %ums", latency);
+    } else if (latency > 0) {
+        retro::warn("Failed to set minimum frontend audio latency to %ums", latency);
+    }
+
+    _frontendAudioActive = false;
+    _frontendOccupancy = TARGET_FRONTEND_OCCUPANCY;
+    _frontendUnderrunLikely = false;
+    _appliedLatency = _targetLatency;
+}
+
+// Called by the frontend before each retro_run, possibly from another thread
+static void melonds::audio::BufferStatusCallback(bool active, unsigned occupancy, bool underrun_likely) noexcept {
+    _frontendAudioActive = active;
+    _frontendOccupancy = std::min(occupancy, 100u);
+    _frontendUnderrunLikely = underrun_likely;
+}
+
+// Submits a little more audio when the frontend's buffer is running low and a little less when it's filling up,
+// so that the frontend can safely run with a smaller buffer.
+// Every extra frame submitted is taken from the ring's cushion, and only the rate controller can put it back
+// (by consuming input slightly slower, i.e. with a slight pitch change).
+// So each frame's adjustment is capped at what the rate controller can repay in a frame at its limit,
+// and the ring's fill at what it can spare without risking an underrun.
+// \c fill is the ring's fill before this frame's output is consumed from it.
+static size_t melonds::audio::AdjustSubmission(size_t outputFrames, double fill) noexcept {
+    if (!_bufferStatusAvailable || !_frontendAudioActive) {
+        // If we don't have any feedback to go on (or the frontend isn't playing audio, e.g. while fast-forwarding)...
+        return outputFrames;
+    }
+
+    TracyPlot("Frontend Audio Occupancy", static_cast<int64_t>(_frontendOccupancy));
+
+    double maxDeviation = _outputFramesPerRun * MAX_RATIO_DEVIATION;
+    double error = (static_cast<double>(TARGET_FRONTEND_OCCUPANCY) - _frontendOccupancy) / TARGET_FRONTEND_OCCUPANCY;
+    if (_frontendUnderrunLikely) {
+        error = 1.0;
+    }
+    double adjustment = maxDeviation * std::clamp(error, -1.0, 1.0);
+
+    // The output frames the ring can supply this frame while keeping the minimum cushion
+    double spare = (fill - MIN_FEEDBACK_CUSHION) / _ratio - static_cast<double>(outputFrames);
+    adjustment = std::min(adjustment, std::max(spare, 0.0));
+
+    long adjusted = static_cast<long>(outputFrames) + static_cast<long>(adjustment); // Rounds toward no adjustment
+    return std::clamp<long>(adjusted, 0, static_cast<long>(_outputBuffer.size() / 2));
+}
+
+void melonds::audio::Drain() noexcept {
+    DrainSpu();
+}
+
+// Moves everything the SPU has produced into the ring, rather than just the first buffer's worth
+static void melonds::audio::DrainSpu() noexcept {
+    ZoneScopedN("melonds::audio::DrainSpu");
+    const int chunkSize = static_cast<int>(_spuBuffer.size() / 2);
+
+    while (SPU::GetOutputSize() > 0) {
+        int read = SPU::ReadOutput(_spuBuffer.data(), std::min(SPU::GetOutputSize(), chunkSize));
+        if (read <= 0) {
+            break;
+        }
+
+        if (_captureEnabled) {
+            Capture(_spuBuffer.data(), read);
+        }
+
+        size_t written = _ring.Write(_spuBuffer.data(), read);
+
+        // Find the last audible frame in what we just wrote, if any
+        const int16_t* frames = _spuBuffer.data();
+        size_t audible = written;
+        while (audible > 0 && frames[audible * 2 - 1] == 0 && frames[audible * 2 - 2] == 0) {
+            --audible;
+        }
+        _silentFrames = (audible == 0) ? _silentFrames + written : written - audible;
+
+        if (written < static_cast<size_t>(read)) {
+            // If the ring is full, the frontend isn't keeping up; drop the excess
+            _overruns++;
+            retro::debug("Audio ring is full, dropped %zu frames", static_cast<size_t>(read) - written);
+        }
+    }
+}
+
+static void melonds::audio::OpenCapture() noexcept {
+    ZoneScopedN("melonds::audio::OpenCapture");
+    const std::optional<std::string>& save_directory = retro::get_save_directory();
+    if (!save_directory) {
+        retro::error("Failed to get save directory; can't capture audio");
+        _captureEnabled = false;
+        return;
+    }
+
+    char path[PATH_MAX];
+    fill_pathname_join_special(path, save_directory->c_str(), CAPTURE_FILE_NAME, sizeof(path));
+    _captureFile = filestream_open(path, RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+    if (!_captureFile) {
+        retro::error("Failed to open audio capture file \"%s\"", path);
+        _captureEnabled = false;
+        return;
+    }
+
+    CaptureHeader header { {'M', 'D', 'S', 'A'}, CAPTURE_VERSION, static_cast<uint32_t>(SAMPLE_RATE) };
+    if (filestream_write(_captureFile, &header, sizeof(header)) != sizeof(header)) {
+        retro::error("Failed to write to audio capture file \"%s\"; capture disabled", path);
+        CloseCapture();
+        _captureEnabled = false;
+        return;
+    }
+
+    retro::info("Capturing SPU output to \"%s\"", path);
+}
+
+static void melonds::audio::CloseCapture() noexcept {
+    if (_captureFile) {
+        filestream_close(_captureFile);
+        _captureFile = nullptr;
+    }
+}
+
+static void melonds::audio::Capture(const int16_t* frames, size_t count) noexcept {
+    ZoneScopedN("melonds::audio::Capture");
+    if (!_captureFile) {
+        OpenCapture();
+        if (!_captureFile) {
+            return;
+        }
+    }
+
+    CaptureRecord record { NDS::NumFrames, static_cast<uint32_t>(count) };
+    int64_t size = static_cast<int64_t>(count * 2 * sizeof(int16_t));
+    if (filestream_write(_captureFile, &record, sizeof(record)) != sizeof(record) || filestream_write(_captureFile, frames, size) != size) {
+        // If the disk is full (or the file went away)...
+        // Stop here, so that the only damage is a truncated record at the end of the capture
+        retro::error("Failed to write to audio capture file; capture disabled");
+        CloseCapture();
+        _captureEnabled = false;
+    }
+}
+
+// Produces outputFrames frames out of the ring, advancing by ratio input frames per output frame.
+// Returns how many frames were actually produced.
+static size_t melonds::audio::Resample(int16_t* output, size_t outputFrames, double ratio) noexcept {
+    size_t produced;
+    if (_skipSilence && _silentFrames >= _ring.Size()) {
+        // If there's nothing to hear in the ring...
+        produced = ResampleSilence(output, outputFrames, ratio);
+        _skippedFrames += produced;
+    } else if (_history > 0) {
+        produced = ResampleSinc(output, outputFrames, ratio);
+    } else {
+        produced = ResampleLinear(output, outputFrames, ratio);
+    }
+
+    // Release the frames we've fully passed (except for the filter's history), keeping the fractional position
+    size_t passed = static_cast<size_t>(_position);
+    size_t consumed = std::min(passed - std::min(passed, _history), _ring.Size());
+    _ring.Consume(consumed);
+    _position -= consumed;
+
+    return produced;
+}
+
+// Resampling silence can only produce silence, so this just advances the position
+// exactly as far as ResampleLinear or ResampleSinc would have, without touching any samples.
+// The SPU has still mixed every one of those silent samples; only the resampler's share of the work is saved.
+static size_t melonds::audio::ResampleSilence(int16_t* output, size_t outputFrames, double ratio) noexcept {
+    ZoneScopedN("melonds::audio::ResampleSilence");
+    size_t available = _ring.Size();
+    size_t lookahead = _history > 0 ? FILTER_TAPS / 2 : 1;
+    size_t produced = 0;
+
+    for (; produced < outputFrames; ++produced) {
+        size_t index = static_cast<size_t>(_position);
+        if (index < _history || index + lookahead >= available) {
+            break;
+        }
+        _position += ratio;
+    }
+
+    std::fill(output, output + produced * 2, 0);
+    return produced;
+}
+
+// Used when the output rate matches the SPU's, so the ratio only deviates from 1 by a fraction of a percent
+static size_t melonds::audio::ResampleLinear(int16_t* output, size_t outputFrames, double ratio) noexcept {
+    ZoneScopedN("melonds::audio::ResampleLinear");
+    size_t available = _ring.Size();
+    size_t produced = 0;
+
+    for (; produced < outputFrames; ++produced) {
+        size_t index = static_cast<size_t>(_position);
+        if (index + 1 >= available) {
+            // If we need a frame that the SPU hasn't produced yet...
+            break;
+        }
+
+        double t = _position - index;
+        const int16_t* a = _ring.Peek(index);
+        const int16_t* b = _ring.Peek(index + 1);
+        output[produced * 2] = static_cast<int16_t>(std::lround(a[0] + (b[0] - a[0]) * t));
+        output[produced * 2 + 1] = static_cast<int16_t>(std::lround(a[1] + (b[1] - a[1]) * t));
+        _position += ratio;
+    }
+
+    return produced;
+}
+
+// Builds a Blackman-windowed sinc low-pass filter for the current output rate,
+// one row per fractional position between input frames.
+static void melonds::audio::BuildFilter() noexcept {
+    ZoneScopedN("melonds::audio::BuildFilter");
+
+    // When downsampling, cut off at the output's Nyquist frequency rather than the input's
+    double cutoff = std::min(1.0, _outputRate / SAMPLE_RATE) * FILTER_CUTOFF;
+    constexpr double CENTER = FILTER_HISTORY;
+    constexpr double PI = 3.14159265358979323846;
+
+    for (size_t phase = 0; phase <= FILTER_PHASES; ++phase) {
+        double offset = static_cast<double>(phase) / FILTER_PHASES;
+        std::array<float, FILTER_TAPS>& taps = _filter[phase].Taps;
+        double sum = 0;
+
+        for (size_t tap = 0; tap < FILTER_TAPS; ++tap) {
+            // Distance from this tap to the (fractional) position being sampled
+            double x = static_cast<double>(tap) - CENTER - offset;
+            double sinc = x == 0 ? 1.0 : std::sin(PI * cutoff * x) / (PI * cutoff * x);
+
+            // Window over the filter's full span, centered on the sampled position
+            double w = (x + FILTER_TAPS / 2.0) / FILTER_TAPS;
+            double window = (w <= 0 || w >= 1) ? 0 : 0.42 - 0.5 * std::cos(2 * PI * w) + 0.08 * std::cos(4 * PI * w);
+
+            taps[tap] = static_cast<float>(sinc * window);
+            sum += taps[tap];
+        }
+
+        // Normalize each phase to unity gain, so that there's no ripple in volume between phases
+        for (float& tap : taps) {
+            tap = static_cast<float>(tap / sum);
+        }
+    }
+}
+
+// Splits interleaved stereo frames into planar floats
+static void melonds::audio::Deinterleave(const int16_t* frames, size_t count, float* left, float* right) noexcept {
+    size_t i = 0;
+#if defined(MELONDS_DS_AUDIO_SSE)
+    for (; i + 4 <= count; i += 4) {
+        // Each 32-bit lane holds one frame, with the left sample in its low half
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(frames + i * 2));
+        _mm_storeu_ps(left + i, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16)));
+        _mm_storeu_ps(right + i, _mm_cvtepi32_ps(_mm_srai_epi32(v, 16)));
+    }
+#elif defined(MELONDS_DS_AUDIO_NEON)
+    for (; i + 8 <= count; i += 8) {
+        int16x8x2_t v = vld2q_s16(frames + i * 2);
+        vst1q_f32(left + i, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[0]))));
+        vst1q_f32(left + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[0]))));
+        vst1q_f32(right + i, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[1]))));
+        vst1q_f32(right + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[1]))));
+    }
+#endif
+    for (; i < count; ++i) {
+        left[i] = frames[i * 2];
+        right[i] = frames[i * 2 + 1];
+    }
+}
+
+// taps must be 16-byte aligned, samples needn't be
+static float melonds::audio::DotProduct(const float* samples, const float* taps) noexcept {
+#if defined(MELONDS_DS_AUDIO_SSE)
+    __m128 sum = _mm_mul_ps(_mm_loadu_ps(samples), _mm_load_ps(taps));
+    for (size_t i = 4; i < FILTER_TAPS; i += 4) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(samples + i), _mm_load_ps(taps + i)));
+    }
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#elif defined(MELONDS_DS_AUDIO_NEON)
+    float32x4_t sum = vmulq_f32(vld1q_f32(samples), vld1q_f32(taps));
+    for (size_t i = 4; i < FILTER_TAPS; i += 4) {
+        sum = vmlaq_f32(sum, vld1q_f32(samples + i), vld1q_f32(taps + i));
+    }
+#if defined(__aarch64__)
+    return vaddvq_f32(sum);
+#else
+    float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+#else
+    float sum = 0;
+    for (size_t i = 0; i < FILTER_TAPS; ++i) {
+        sum += samples[i] * taps[i];
+    }
+    return sum;
+#endif
+}
+
+// Used when the output rate differs from the SPU's.
+// The ring's contents are converted to floats once per call, rather than once per tap.
+static size_t melonds::audio::ResampleSinc(int16_t* output, size_t outputFrames, double ratio) noexcept {
+    ZoneScopedN("melonds::audio::ResampleSinc");
+    size_t available = _ring.Size();
+
+    for (size_t i = 0; i < available;) {
+        // At most two iterations, one on either side of the ring's wrap-around point
+        size_t count = available - i;
+        const int16_t* frames = _ring.PeekContiguous(i, count);
+        Deinterleave(frames, count, &_left[i], &_right[i]);
+        i += count;
+    }
+
+    size_t produced = 0;
+    for (; produced < outputFrames; ++produced) {
+        size_t index = static_cast<size_t>(_position);
+        if (index < FILTER_HISTORY || index + FILTER_TAPS / 2 >= available) {
+            // If we need a frame that the SPU hasn't produced yet...
+            break;
+        }
+
+        size_t phase = static_cast<size_t>(std::lround((_position - index) * FILTER_PHASES));
+        const float* taps = _filter[phase].Taps.data();
+        size_t start = index - FILTER_HISTORY;
+
+        float left = DotProduct(&_left[start], taps);
+        float right = DotProduct(&_right[start], taps);
+        output[produced * 2] = static_cast<int16_t>(std::clamp(std::lround(left), -32768l, 32767l));
+        output[produced * 2 + 1] = static_cast<int16_t>(std::clamp(std::lround(right), -32768l, 32767l));
+        _position += ratio;
+    }
+
+    return produced;
+}
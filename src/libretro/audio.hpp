@@ -0,0 +1,176 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef MELONDS_DS_AUDIO_HPP
+#define MELONDS_DS_AUDIO_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//! Buffering and rate control between the emulated SPU and the frontend.
+
+namespace melonds::audio {
+    /// The nominal sample rate of the emulated SPU, as reported to the frontend.
+    constexpr double SAMPLE_RATE = 32.0 * 1024.0;
+
+    /// The emulated console's refresh rate, as reported to the frontend.
+    constexpr double FPS = 32.0 * 1024.0 * 1024.0 / 560190.0;
+
+    /// A single-producer, single-consumer ring of interleaved stereo frames.
+    /// The producer only ever moves the write index and the consumer only ever moves the read index,
+    /// so neither side needs a lock.
+    /// \tparam N Capacity in stereo frames; must be a power of two.
+    template<size_t N>
+    class AudioRing {
+        static_assert(N > 0 && (N & (N - 1)) == 0, "AudioRing capacity must be a power of two");
+    public:
+        static constexpr size_t Capacity() noexcept { return N; }
+
+        /// The number of frames available to the consumer.
+        [[nodiscard]] size_t Size() const noexcept {
+            return _write.load(std::memory_order_acquire) - _read.load(std::memory_order_acquire);
+        }
+
+        /// The number of frames that the producer can write without overwriting unread data.
+        [[nodiscard]] size_t Free() const noexcept { return N - Size(); }
+
+        /// Producer only. Copies up to \c count frames into the ring.
+        /// \returns The number of frames actually written.
+        size_t Write(const int16_t* frames, size_t count) noexcept {
+            size_t write = _write.load(std::memory_order_relaxed);
+            size_t read = _read.load(std::memory_order_acquire);
+            count = std::min(count, N - (write - read));
+
+            // Copy in at most two blocks, one on either side of the wrap-around point
+            size_t start = write & (N - 1);
+            size_t first = std::min(count, N - start);
+            std::memcpy(&_buffer[start * 2], frames, first * 2 * sizeof(int16_t));
+            std::memcpy(&_buffer[0], frames + first * 2, (count - first) * 2 * sizeof(int16_t));
+
+            _write.store(write + count, std::memory_order_release);
+            return count;
+        }
+
+        /// Consumer only. Returns the frame \c offset frames past the read position.
+        /// \c offset must be less than Size().
+        [[nodiscard]] const int16_t* Peek(size_t offset) const noexcept {
+            return &_buffer[((_read.load(std::memory_order_relaxed) + offset) & (N - 1)) * 2];
+        }
+
+        /// Consumer only. Like Peek, but also returns how many frames (up to \c count)
+        /// can be read from the returned pointer before the ring wraps around.
+        [[nodiscard]] const int16_t* PeekContiguous(size_t offset, size_t& count) const noexcept {
+            size_t start = (_read.load(std::memory_order_relaxed) + offset) & (N - 1);
+            count = std::min(count, N - start);
+            return &_buffer[start * 2];
+        }
+
+        /// Consumer only. Discards up to \c count frames from the read position.
+        void Consume(size_t count) noexcept {
+            size_t read = _read.load(std::memory_order_relaxed);
+            count = std::min(count, _write.load(std::memory_order_acquire) - read);
+            _read.store(read + count, std::memory_order_release);
+        }
+
+        /// Not thread-safe; only call this when neither side is active.
+        void Clear() noexcept {
+            _read.store(0, std::memory_order_relaxed);
+            _write.store(0, std::memory_order_relaxed);
+        }
+    private:
+        std::array<int16_t, N * 2> _buffer {};
+        // Free-running indexes; they're masked on access, and unsigned overflow is well-defined.
+        std::atomic<size_t> _read = 0;
+        std::atomic<size_t> _write = 0;
+    };
+
+    struct AudioMetrics {
+        size_t RingFill;
+        size_t RingCapacity;
+
+        /// How many times the ring ran dry before a frame's worth of output was produced.
+        unsigned Underruns;
+
+        /// How many times SPU output had to be discarded because the ring was full.
+        unsigned Overruns;
+
+        /// The most recent resampling ratio (input frames consumed per output frame).
+        double Ratio;
+
+        /// How many output frames were filled with silence without running the resampler,
+        /// because the ring held nothing but silence at the time.
+        size_t SkippedFrames;
+    };
+
+    /// Moves all pending SPU output into the ring,
+    /// then submits one video frame's worth of audio to the frontend.
+    void Render() noexcept;
+
+    /// Moves all pending SPU output into the ring without submitting anything,
+    /// so that it won't be mixed up with output from frames that are about to be discarded
+    /// (e.g. by run-ahead).
+    void Drain() noexcept;
+
+    /// Discards all buffered audio and resets the rate controller and metrics.
+    void Reset() noexcept;
+
+    /// Sets the sample rate to submit audio at, resampling the SPU's output in-core if it differs.
+    /// Discards all buffered audio.
+    /// Only call this before reporting the AV info to the frontend, since that's the only time it can change.
+    /// \param rate The output rate in Hz, or 0 for the SPU's native rate.
+    void SetOutputSampleRate(unsigned rate) noexcept;
+
+    /// The sample rate that audio is submitted at.
+    [[nodiscard]] unsigned OutputSampleRate() noexcept;
+
+    /// Sets the frontend audio latency (in milliseconds) to aim for,
+    /// or 0 to leave the frontend's buffering alone.
+    /// Takes effect at the next call to Render,
+    /// since the relevant environment calls are only valid there.
+    void SetTargetLatency(unsigned latency) noexcept;
+
+    /// Sets whether to skip the resampler while the ring holds nothing but silence (on by default).
+    /// The output is the same either way; this exists so that the shortcut can be tested and measured.
+    void SetSilenceSkipping(bool enabled) noexcept;
+
+    /// Starts or stops recording the SPU's raw output to a capture file in the save directory.
+    /// The file starts with a CaptureHeader, followed by one CaptureRecord (and its frames)
+    /// for each chunk of SPU output, all in native byte order.
+    /// Each capture starts over at the next Reset.
+    void SetCaptureEnabled(bool enabled) noexcept;
+
+    struct CaptureHeader {
+        char Magic[4]; // "MDSA"
+        uint32_t Version;
+        uint32_t SampleRate;
+    };
+
+    struct CaptureRecord {
+        /// The value of NDS::NumFrames when this chunk was read.
+        uint32_t Frame;
+
+        /// The number of interleaved stereo frames that follow.
+        uint32_t Count;
+    };
+
+    [[nodiscard]] AudioMetrics Metrics() noexcept;
+}
+
+#endif //MELONDS_DS_AUDIO_HPP
@@ -187,6 +187,20 @@ namespace melonds {
             [[nodiscard]] BitDepth BitDepth() noexcept;
             [[nodiscard]] AudioInterpolation Interpolation() noexcept;
 
+            /// The frontend audio latency to aim for in milliseconds,
+            /// or 0 if the frontend should manage latency on its own.
+            [[nodiscard]] unsigned TargetLatency() noexcept;
+
+            /// The sample rate to resample audio to in-core,
+            /// or 0 to submit it at the SPU's native rate and let the frontend resample it.
+            [[nodiscard]] unsigned OutputSampleRate() noexcept;
+
+            #ifndef NDEBUG
+            [[nodiscard]] bool CaptureAudio() noexcept;
+            #else
+            [[nodiscard]] constexpr bool CaptureAudio() noexcept { return false; }
+            #endif
+
             [[nodiscard]] MicButtonMode MicButtonMode() noexcept;
             [[nodiscard]] MicInputMode MicInputMode() noexcept;
         }
@@ -225,6 +239,25 @@ namespace melonds {
             [[nodiscard]] bool ShowCurrentLayout() noexcept;
             [[nodiscard]] bool ShowLidState() noexcept;
             [[nodiscard]] bool ShowBrightnessState() noexcept;
+            [[nodiscard]] bool ShowAudioBufferState() noexcept;
+        }
+
+        namespace savestate {
+            /// How often (in minutes) to write an auto-save state, or 0 if auto-save states are disabled.
+            [[nodiscard]] unsigned AutoSaveStateInterval() noexcept;
+            [[nodiscard]] bool CompressSavestates() noexcept;
+
+            /// The memory (in MiB) to set aside for the in-core rewind history, or 0 if rewind is disabled.
+            [[nodiscard]] unsigned RewindBufferSize() noexcept;
+
+            /// How many frames ahead of the real one to show, or 0 if run-ahead is disabled.
+            [[nodiscard]] unsigned RunAheadFrames() noexcept;
+
+            #ifndef NDEBUG
+            [[nodiscard]] bool TraceStateHashes() noexcept;
+            #else
+            [[nodiscard]] constexpr bool TraceStateHashes() noexcept { return false; }
+            #endif
         }
 
         namespace system {
@@ -287,6 +320,12 @@ namespace melonds {
             [[nodiscard]] GPU::RenderSettings RenderSettings() noexcept;
             [[nodiscard]] ScreenFilter ScreenFilter() noexcept;
             [[nodiscard]] int ScaleFactor() noexcept;
+
+            #ifndef NDEBUG
+            [[nodiscard]] bool CaptureVideo() noexcept;
+            #else
+            [[nodiscard]] constexpr bool CaptureVideo() noexcept { return false; }
+            #endif
         }
     }
 }
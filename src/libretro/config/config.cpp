@@ -37,6 +37,7 @@
 #include <SPI.h>
 #include <SPI_Firmware.h>
 
+#include "audio.hpp"
 #include "config/constants.hpp"
 #include "config/definitions.hpp"
 #include "config/definitions/categories.hpp"
@@ -44,11 +45,13 @@
 #include "exceptions.hpp"
 #include "input.hpp"
 #include "libretro.hpp"
-#include "microphone.hpp"
 #include "opengl.hpp"
 #include "render.hpp"
 #include "retro/dirent.hpp"
+#include "retro/microphone.hpp"
+#include "rewind.hpp"
 #include "screenlayout.hpp"
+#include "statehash.hpp"
 #include "tracy.hpp"
 
 using std::array;
@@ -75,6 +78,7 @@ const initializer_list<unsigned> SCREEN_GAP_LENGTHS = {0, 1, 2, 8, 16, 24, 32, 4
 const initializer_list<unsigned> CURSOR_TIMEOUTS = {1, 2, 3, 5, 10, 15, 20, 30, 60};
 const initializer_list<unsigned> DS_POWER_OK_THRESHOLDS = {0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100};
 const initializer_list<unsigned> POWER_UPDATE_INTERVALS = {1, 2, 3, 5, 10, 15, 20, 30, 60};
+const initializer_list<unsigned> AUTO_SAVE_STATE_INTERVALS = {1, 5, 10, 15, 30};
 
 namespace Config {
     // Needed by melonDS's wi-fi implementation
@@ -110,6 +114,7 @@ namespace melonds::config {
     static void parse_firmware_options() noexcept;
     static void parse_audio_options() noexcept;
     static void parse_network_options() noexcept;
+    static void parse_savestate_options() noexcept;
 
     /// @returns true if the OpenGL state needs to be rebuilt
     static bool parse_video_options(bool initializing) noexcept;
@@ -123,6 +128,8 @@ namespace melonds::config {
     static void apply_system_options(const optional <NDSHeader>& header);
 
     static void apply_audio_options() noexcept;
+    static void apply_savestate_options() noexcept;
+    static void apply_video_options() noexcept;
     static void apply_save_options(const optional<NDSHeader>& header);
     static void apply_screen_options(ScreenLayoutData& screenLayout, InputState& inputState) noexcept;
 
@@ -138,6 +145,17 @@ namespace melonds::config {
 
         melonds::AudioInterpolation _interpolation;
         melonds::AudioInterpolation Interpolation() noexcept { return _interpolation; }
+
+        static unsigned _targetLatency = 0;
+        unsigned TargetLatency() noexcept { return _targetLatency; }
+
+        static unsigned _outputSampleRate = 0;
+        unsigned OutputSampleRate() noexcept { return _outputSampleRate; }
+
+#ifndef NDEBUG
+        static bool _captureAudio = false;
+        bool CaptureAudio() noexcept { return _captureAudio; }
+#endif
     }
 
     namespace firmware {
@@ -219,6 +237,9 @@ namespace melonds::config {
 
         static bool showBrightnessState = false;
         [[nodiscard]] bool ShowBrightnessState() noexcept { return showBrightnessState; }
+
+        static bool showAudioBufferState = false;
+        [[nodiscard]] bool ShowAudioBufferState() noexcept { return showAudioBufferState; }
     }
 
     namespace save {
@@ -262,6 +283,25 @@ namespace melonds::config {
         unsigned FlushDelay() noexcept { return _flushDelay; }
     }
 
+    namespace savestate {
+        static unsigned _autoSaveStateInterval = 0;
+        unsigned AutoSaveStateInterval() noexcept { return _autoSaveStateInterval; }
+
+        static bool _compressSavestates = false;
+        bool CompressSavestates() noexcept { return _compressSavestates; }
+
+        static unsigned _rewindBufferSize = 0;
+        unsigned RewindBufferSize() noexcept { return _rewindBufferSize; }
+
+        static unsigned _runAheadFrames = 0;
+        unsigned RunAheadFrames() noexcept { return _runAheadFrames; }
+
+#ifndef NDEBUG
+        static bool _traceStateHashes = false;
+        bool TraceStateHashes() noexcept { return _traceStateHashes; }
+#endif
+    }
+
     namespace screen {
         static unsigned _numberOfScreenLayouts = 1;
         unsigned NumberOfScreenLayouts() noexcept { return _numberOfScreenLayouts; }
@@ -337,6 +377,11 @@ namespace melonds::config {
         melonds::ScreenFilter ScreenFilter() noexcept { return _screenFilter; }
 
         int ScaleFactor() noexcept { return RenderSettings().GL_ScaleFactor; }
+
+#ifndef NDEBUG
+        static bool _captureVideo = false;
+        bool CaptureVideo() noexcept { return _captureVideo; }
+#endif
     }
 }
 
@@ -353,12 +398,15 @@ void melonds::InitConfig(const optional<struct retro_game_info>& nds_info, const
     config::parse_firmware_options();
     config::parse_audio_options();
     config::parse_network_options();
+    config::parse_savestate_options();
     bool openGlNeedsRefresh = config::parse_video_options(true);
     config::parse_screen_options();
 
     config::apply_system_options(header);
     config::apply_save_options(header);
     config::apply_audio_options();
+    config::apply_savestate_options();
+    config::apply_video_options();
     config::apply_screen_options(screenLayout, inputState);
 
 #if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
@@ -379,11 +427,14 @@ void melonds::InitConfig(const optional<struct retro_game_info>& nds_info, const
 
 void melonds::UpdateConfig(ScreenLayoutData& screenLayout, InputState& inputState) noexcept {
     config::parse_audio_options();
+    config::parse_savestate_options();
     bool openGlNeedsRefresh = config::parse_video_options(false);
     config::parse_screen_options();
     config::parse_osd_options();
 
     config::apply_audio_options();
+    config::apply_savestate_options();
+    config::apply_video_options();
     config::apply_screen_options(screenLayout, inputState);
 
 #if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
@@ -598,6 +649,13 @@ static void melonds::config::parse_osd_options() noexcept {
         retro::warn("Failed to get value for %s; defaulting to %s", LID_STATE, values::DISABLED);
         showLidState = false;
     }
+
+    if (optional<bool> value = ParseBoolean(get_variable(osd::AUDIO_BUFFER_STATE))) {
+        showAudioBufferState = *value;
+    } else {
+        retro::warn("Failed to get value for %s; defaulting to %s", AUDIO_BUFFER_STATE, values::DISABLED);
+        showAudioBufferState = false;
+    }
 }
 
 static void melonds::config::parse_jit_options() noexcept {
@@ -833,9 +891,95 @@ static void melonds::config::parse_audio_options() noexcept {
         retro::warn("Failed to get value for %s; defaulting to %s", AUDIO_INTERPOLATION, values::DISABLED);
         _interpolation = AudioInterpolation::None;
     }
+
+    if (const char* value = get_variable(AUDIO_LATENCY); !string_is_empty(value)) {
+        if (optional<unsigned> latency = ParseIntegerInList(value, {32u, 48u, 64u, 96u})) {
+            _targetLatency = *latency;
+        } else {
+            _targetLatency = 0;
+        }
+    } else {
+        retro::warn("Failed to get value for %s; defaulting to %s", AUDIO_LATENCY, values::DISABLED);
+        _targetLatency = 0;
+    }
+
+    if (const char* value = get_variable(AUDIO_SAMPLE_RATE); !string_is_empty(value)) {
+        if (optional<unsigned> rate = ParseIntegerInList(value, {44100u, 48000u})) {
+            _outputSampleRate = *rate;
+        } else {
+            _outputSampleRate = 0;
+        }
+    } else {
+        retro::warn("Failed to get value for %s; defaulting to %s", AUDIO_SAMPLE_RATE, values::DISABLED);
+        _outputSampleRate = 0;
+    }
+
+#ifndef NDEBUG
+    if (optional<bool> value = ParseBoolean(get_variable(AUDIO_CAPTURE))) {
+        _captureAudio = *value;
+    } else {
+        retro::warn("Failed to get value for %s; defaulting to %s", AUDIO_CAPTURE, values::DISABLED);
+        _captureAudio = false;
+    }
+#endif
 }
 
 
+static void melonds::config::parse_savestate_options() noexcept {
+    ZoneScopedN("melonds::config::parse_savestate_options");
+    using namespace melonds::config::savestate;
+    using retro::get_variable;
+
+    if (const char* value = get_variable(AUTO_SAVE_STATE_INTERVAL); !string_is_empty(value)) {
+        if (optional<unsigned> interval = ParseIntegerInList(value, AUTO_SAVE_STATE_INTERVALS)) {
+            _autoSaveStateInterval = *interval;
+        } else {
+            _autoSaveStateInterval = 0;
+        }
+    } else {
+        retro::warn("Failed to get value for %s; defaulting to %s", AUTO_SAVE_STATE_INTERVAL, values::DISABLED);
+        _autoSaveStateInterval = 0;
+    }
+
+    if (const optional<bool> value = ParseBoolean(get_variable(COMPRESS_SAVESTATES))) {
+        _compressSavestates = *value;
+    } else {
+        retro::warn("Failed to get value for %s; defaulting to %s", COMPRESS_SAVESTATES, values::DISABLED);
+        _compressSavestates = false;
+    }
+
+    if (const char* value = get_variable(REWIND_BUFFER_SIZE); !string_is_empty(value)) {
+        if (optional<unsigned> size = ParseIntegerInList(value, {64u, 128u, 256u, 512u})) {
+            _rewindBufferSize = *size;
+        } else {
+            _rewindBufferSize = 0;
+        }
+    } else {
+        retro::warn("Failed to get value for %s; defaulting to %s", REWIND_BUFFER_SIZE, values::DISABLED);
+        _rewindBufferSize = 0;
+    }
+
+    if (const char* value = get_variable(RUN_AHEAD_FRAMES); !string_is_empty(value)) {
+        if (optional<unsigned> frames = ParseIntegerInList(value, {1u, 2u, 3u, 4u})) {
+            _runAheadFrames = *frames;
+        } else {
+            _runAheadFrames = 0;
+        }
+    } else {
+        retro::warn("Failed to get value for %s; defaulting to %s", RUN_AHEAD_FRAMES, values::DISABLED);
+        _runAheadFrames = 0;
+    }
+
+#ifndef NDEBUG
+    if (const optional<bool> value = ParseBoolean(get_variable(TRACE_STATE_HASHES))) {
+        _traceStateHashes = *value;
+    } else {
+        retro::warn("Failed to get value for %s; defaulting to %s", TRACE_STATE_HASHES, values::DISABLED);
+        _traceStateHashes = false;
+    }
+#endif
+}
+
 static void melonds::config::parse_network_options() noexcept {
     ZoneScopedN("melonds::config::parse_network_options");
     using retro::get_variable;
@@ -911,6 +1055,15 @@ static bool melonds::config::parse_video_options(bool initializing) noexcept {
     }
 #endif
 
+#ifndef NDEBUG
+    if (optional<bool> value = ParseBoolean(get_variable(VIDEO_CAPTURE))) {
+        _captureVideo = *value;
+    } else {
+        retro::warn("Failed to get value for %s; defaulting to %s", VIDEO_CAPTURE, values::DISABLED);
+        _captureVideo = false;
+    }
+#endif
+
     return needsOpenGlRefresh;
 }
 
@@ -1328,7 +1481,16 @@ static void melonds::config::apply_audio_options() noexcept {
         }
     }
 
+    // TODO: Vectorize the mixing and interpolation that this selects (see the roadmap in README.md)
     SPU::SetInterpolation(static_cast<int>(config::audio::Interpolation()));
+    melonds::audio::SetTargetLatency(config::audio::TargetLatency());
+    melonds::audio::SetCaptureEnabled(config::audio::CaptureAudio());
+}
+
+static void melonds::config::apply_savestate_options() noexcept {
+    ZoneScopedN("melonds::config::apply_savestate_options");
+    melonds::rewind::SetBufferSize(static_cast<size_t>(config::savestate::RewindBufferSize()) * 1024 * 1024);
+    melonds::statehash::SetTraceEnabled(config::savestate::TraceStateHashes());
 }
 
 static void melonds::config::apply_save_options(const optional<NDSHeader>& header) {
@@ -1409,6 +1571,11 @@ static void melonds::config::apply_save_options(const optional<NDSHeader>& heade
     }
 }
 
+static void melonds::config::apply_video_options() noexcept {
+    ZoneScopedN("melonds::config::apply_video_options");
+    melonds::render::SetCaptureEnabled(config::video::CaptureVideo());
+}
+
 static void melonds::config::apply_screen_options(ScreenLayoutData& screenLayout, InputState& inputState) noexcept {
     ZoneScopedN("melonds::config::apply_screen_options");
     using namespace config::video;
@@ -39,7 +39,10 @@ namespace melonds::config {
     namespace audio {
         static constexpr const char *const CATEGORY = "audio";
         static constexpr const char *const AUDIO_BITDEPTH = "melonds_audio_bitdepth";
+        static constexpr const char *const AUDIO_CAPTURE = "melonds_audio_capture";
         static constexpr const char *const AUDIO_INTERPOLATION = "melonds_audio_interpolation";
+        static constexpr const char *const AUDIO_LATENCY = "melonds_audio_latency";
+        static constexpr const char *const AUDIO_SAMPLE_RATE = "melonds_audio_sample_rate";
         static constexpr const char *const MIC_INPUT = "melonds_mic_input";
         static constexpr const char *const MIC_INPUT_BUTTON = "melonds_mic_input_active";
     }
@@ -84,6 +87,16 @@ namespace melonds::config {
         static constexpr const char *const CURRENT_LAYOUT = "melonds_show_current_layout";
         static constexpr const char *const LID_STATE = "melonds_show_lid_state";
         static constexpr const char *const BRIGHTNESS_STATE = "melonds_show_brightness_state";
+        static constexpr const char *const AUDIO_BUFFER_STATE = "melonds_show_audio_buffer_state";
+    }
+
+    namespace savestate {
+        static constexpr const char *const AUTO_SAVE_STATE_INTERVAL = "melonds_auto_save_state_interval";
+        static constexpr const char *const CATEGORY = "savestate";
+        static constexpr const char *const COMPRESS_SAVESTATES = "melonds_compress_savestates";
+        static constexpr const char *const REWIND_BUFFER_SIZE = "melonds_rewind_buffer_size";
+        static constexpr const char *const RUN_AHEAD_FRAMES = "melonds_run_ahead_frames";
+        static constexpr const char *const TRACE_STATE_HASHES = "melonds_trace_state_hashes";
     }
 
     namespace screen {
@@ -144,6 +157,7 @@ namespace melonds::config {
         static constexpr const char *const OPENGL_RESOLUTION = "melonds_opengl_resolution";
         static constexpr const char *const RENDER_MODE = "melonds_render_mode";
         static constexpr const char *const THREADED_RENDERER = "melonds_threaded_renderer";
+        static constexpr const char *const VIDEO_CAPTURE = "melonds_video_capture";
     }
 
     namespace values {
@@ -28,6 +28,7 @@
 #include "config/definitions/firmware.hpp"
 #include "config/definitions/network.hpp"
 #include "config/definitions/osd.hpp"
+#include "config/definitions/savestate.hpp"
 #include "config/definitions/screen.hpp"
 #include "config/definitions/storage.hpp"
 #include "config/definitions/system.hpp"
@@ -45,6 +46,7 @@ namespace melonds::config::definitions {
         ScreenOptionDefinitions<L>,
         FirmwareOptionDefinitions<L>,
         StorageOptionDefinitions<L>,
+        SavestateOptionDefinitions<L>,
         SystemOptionDefinitions<L>,
         VideoOptionDefinitions<L>,
         OsdOptionDefinitions<L>,
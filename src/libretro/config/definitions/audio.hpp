@@ -14,8 +14,8 @@
     with melonDS DS. If not, see http://www.gnu.org/licenses/.
 */
 
-#ifndef MELONDS_DS_AUDIO_HPP
-#define MELONDS_DS_AUDIO_HPP
+#ifndef MELONDS_DS_CONFIG_DEFINITIONS_AUDIO_HPP
+#define MELONDS_DS_CONFIG_DEFINITIONS_AUDIO_HPP
 
 #include <initializer_list>
 #include <libretro.h>
@@ -106,6 +106,70 @@ namespace melonds::config::definitions {
             },
             melonds::config::values::DISABLED
         },
+        retro_core_option_v2_definition {
+            config::audio::AUDIO_LATENCY,
+            "Low-Latency Audio",
+            nullptr,
+            "Asks the frontend to keep at least this much audio buffered, "
+            "and adjusts how much audio is submitted each frame "
+            "to keep the frontend's buffer about half full. "
+            "This lets you use a lower audio latency in the frontend "
+            "without crackling on slower devices. "
+            "Requires frontend support; has no effect otherwise.\n"
+            "\n"
+            "If unsure, leave this disabled.",
+            nullptr,
+            config::audio::CATEGORY,
+            {
+                {melonds::config::values::DISABLED, nullptr},
+                {"32", "32ms"},
+                {"48", "48ms"},
+                {"64", "64ms"},
+                {"96", "96ms"},
+                {nullptr, nullptr},
+            },
+            melonds::config::values::DISABLED
+        },
+        retro_core_option_v2_definition {
+            config::audio::AUDIO_SAMPLE_RATE,
+            "Output Sample Rate",
+            nullptr,
+            "Resamples audio to this rate before submitting it to the frontend, "
+            "so that the frontend doesn't have to. "
+            "Choose your audio device's rate to save some CPU time on slower devices. "
+            "Takes effect at next restart.\n"
+            "\n"
+            "If unsure, leave this disabled.",
+            nullptr,
+            config::audio::CATEGORY,
+            {
+                {melonds::config::values::DISABLED, "Disabled (32768Hz)"},
+                {"44100", "44100Hz"},
+                {"48000", "48000Hz"},
+                {nullptr, nullptr},
+            },
+            melonds::config::values::DISABLED
+        },
+#ifndef NDEBUG
+        retro_core_option_v2_definition {
+            config::audio::AUDIO_CAPTURE,
+            "Capture SPU Output",
+            nullptr,
+            "Enable to record the SPU's raw output to a file in the save directory, "
+            "starting over whenever the game is loaded or reset. "
+            "Useful for checking that changes to the mixer don't change its output. "
+            "Used for debugging. "
+            "Leave disabled if unsure.",
+            nullptr,
+            config::audio::CATEGORY,
+            {
+                {melonds::config::values::DISABLED, nullptr},
+                {melonds::config::values::ENABLED, nullptr},
+                {nullptr, nullptr},
+            },
+            melonds::config::values::DISABLED
+        },
+#endif
     };
 }
-#endif //MELONDS_DS_AUDIO_HPP
+#endif //MELONDS_DS_CONFIG_DEFINITIONS_AUDIO_HPP
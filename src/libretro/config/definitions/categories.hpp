@@ -55,6 +55,11 @@ namespace melonds::config::definitions {
             "Storage",
             "Change emulated SD card, NAND image, and save data settings."
         },
+        retro_core_option_v2_category {
+            melonds::config::savestate::CATEGORY,
+            "Savestates & Rewind",
+            "Change how savestates are made and kept."
+        },
         retro_core_option_v2_category {
             melonds::config::network::CATEGORY,
             "Network",
@@ -113,6 +113,23 @@ namespace melonds::config::definitions {
             },
             melonds::config::values::ENABLED
         },
+        retro_core_option_v2_definition {
+            config::osd::AUDIO_BUFFER_STATE,
+            "Show Audio Buffer State",
+            nullptr,
+            "Enable to show how full the core's audio buffer is "
+            "and how many times it has run dry. "
+            "Useful for tuning the frontend's audio latency. "
+            "Leave disabled if unsure.",
+            nullptr,
+            config::osd::CATEGORY,
+            {
+                {melonds::config::values::ENABLED, nullptr},
+                {melonds::config::values::DISABLED, nullptr},
+                {nullptr, nullptr},
+            },
+            melonds::config::values::DISABLED
+        },
 #ifndef NDEBUG
         retro_core_option_v2_definition {
             config::osd::POINTER_COORDINATES,
@@ -0,0 +1,150 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef MELONDS_DS_CONFIG_DEFINITIONS_SAVESTATE_HPP
+#define MELONDS_DS_CONFIG_DEFINITIONS_SAVESTATE_HPP
+
+#include <initializer_list>
+#include <libretro.h>
+
+#include "../constants.hpp"
+
+namespace melonds::config::definitions {
+    template<retro_language L>
+    constexpr std::initializer_list<retro_core_option_v2_definition> SavestateOptionDefinitions {
+        retro_core_option_v2_definition {
+            config::savestate::AUTO_SAVE_STATE_INTERVAL,
+            "Auto-Save State Interval",
+            nullptr,
+            "Periodically saves the game's state in the background, "
+            "and again when the game is closed, "
+            "so that you can pick up where you left off after a crash. "
+            "The state is written to the save directory as \"<game name>.auto.state\", "
+            "and is loaded automatically the next time the game starts while this is enabled. "
+            "Not available in DSi mode.\n"
+            "\n"
+            "If unsure, leave this disabled.",
+            nullptr,
+            config::savestate::CATEGORY,
+            {
+                {melonds::config::values::DISABLED, nullptr},
+                {"1", "1 minute"},
+                {"5", "5 minutes"},
+                {"10", "10 minutes"},
+                {"15", "15 minutes"},
+                {"30", "30 minutes"},
+                {nullptr, nullptr},
+            },
+            melonds::config::values::DISABLED
+        },
+#ifdef HAVE_ZLIB
+        retro_core_option_v2_definition {
+            config::savestate::COMPRESS_SAVESTATES,
+            "Compress Savestates",
+            nullptr,
+            "Compresses savestates before giving them to the frontend, "
+            "which makes them much smaller (especially when synced to the cloud) "
+            "at the cost of a little time when saving or loading. "
+            "States made for run-ahead or netplay are never compressed. "
+            "Compressed and uncompressed states can both be loaded either way.\n"
+            "\n"
+            "If unsure, leave this disabled.",
+            nullptr,
+            config::savestate::CATEGORY,
+            {
+                {melonds::config::values::DISABLED, nullptr},
+                {melonds::config::values::ENABLED, nullptr},
+                {nullptr, nullptr},
+            },
+            melonds::config::values::DISABLED
+        },
+#endif
+        retro_core_option_v2_definition {
+            config::savestate::REWIND_BUFFER_SIZE,
+            "Rewind Buffer Size",
+            nullptr,
+            "Keeps a history of recent frames in memory, "
+            "which you can rewind through by holding R3. "
+            "Only the parts of each frame that changed are stored. "
+            "Larger buffers let you rewind further back. "
+            "Not available in DSi mode.\n"
+            "\n"
+            "If unsure, leave this disabled.",
+            nullptr,
+            config::savestate::CATEGORY,
+            {
+                {melonds::config::values::DISABLED, nullptr},
+                {"64", "64MB"},
+                {"128", "128MB"},
+                {"256", "256MB"},
+                {"512", "512MB"},
+                {nullptr, nullptr},
+            },
+            melonds::config::values::DISABLED
+        },
+        retro_core_option_v2_definition {
+            config::savestate::RUN_AHEAD_FRAMES,
+            "Run-Ahead",
+            nullptr,
+            "Emulates this many frames past the current one and shows the last of them, "
+            "then goes back; this hides the game's own input lag. "
+            "Unlike the frontend's run-ahead, this doesn't need a second instance of the core "
+            "or a full savestate round trip every frame, "
+            "but it still costs an extra emulated frame per frame of run-ahead. "
+            "Setting this higher than the game's input lag will cause visible jitter. "
+            "Don't use this together with the frontend's run-ahead. "
+            "In DSi mode, this is the only kind of run-ahead available, "
+            "and it pauses while the game is using the DSi's DSP.\n"
+            "\n"
+            "If unsure, leave this disabled.",
+            nullptr,
+            config::savestate::CATEGORY,
+            {
+                {melonds::config::values::DISABLED, nullptr},
+                {"1", "1 frame"},
+                {"2", "2 frames"},
+                {"3", "3 frames"},
+                {"4", "4 frames"},
+                {nullptr, nullptr},
+            },
+            melonds::config::values::DISABLED
+        },
+#ifndef NDEBUG
+        retro_core_option_v2_definition {
+            config::savestate::TRACE_STATE_HASHES,
+            "Trace State Hashes",
+            nullptr,
+            "Writes a hash of the emulator's entire state after every frame "
+            "to \"melonDS DS state hashes.txt\" in the save directory. "
+            "Comparing the files from two runs of the same game (e.g. two netplay peers) "
+            "shows the first frame where they went out of sync. "
+            "Costs about as much as a savestate every frame. "
+            "Used for debugging. "
+            "Leave disabled if unsure.",
+            nullptr,
+            config::savestate::CATEGORY,
+            {
+                {melonds::config::values::DISABLED, nullptr},
+                {melonds::config::values::ENABLED, nullptr},
+                {nullptr, nullptr},
+            },
+            melonds::config::values::DISABLED
+        },
+#endif
+    };
+}
+
+#endif //MELONDS_DS_CONFIG_DEFINITIONS_SAVESTATE_HPP
@@ -117,6 +117,26 @@ namespace melonds::config::definitions {
             },
             melonds::config::values::DISABLED
         },
+#endif
+#ifndef NDEBUG
+        retro_core_option_v2_definition {
+            config::video::VIDEO_CAPTURE,
+            "Capture Composed Frames",
+            nullptr,
+            "Enable to record every composed frame to a file in the save directory, "
+            "starting over whenever the game is loaded or reset. "
+            "The OpenGL renderer reads frames back asynchronously, so recording doesn't stall the GPU. "
+            "Used for debugging. "
+            "Leave disabled if unsure.",
+            nullptr,
+            config::video::CATEGORY,
+            {
+                {melonds::config::values::DISABLED, nullptr},
+                {melonds::config::values::ENABLED, nullptr},
+                {nullptr, nullptr},
+            },
+            melonds::config::values::DISABLED
+        },
 #endif
     };
 }
@@ -30,7 +30,7 @@
 #include <compat/strl.h>
 #include <retro_dirent.h>
 
-#include "microphone.hpp"
+#include "retro/microphone.hpp"
 #include "info.hpp"
 #include "libretro.hpp"
 #include "config.hpp"
@@ -52,6 +52,7 @@ namespace retro {
     static retro_log_printf_t _log;
     static bool _supports_bitmasks;
     static bool _supportsPowerStatus;
+    static bool _usesFrontendVfs;
     static bool isShuttingDown = false;
     static unsigned _message_interface_version;
 
@@ -464,6 +465,10 @@ bool retro::supports_power_status() noexcept {
     return _supportsPowerStatus;
 }
 
+bool retro::uses_frontend_vfs() noexcept {
+    return _usesFrontendVfs;
+}
+
 optional<retro_device_power> retro::get_device_power() noexcept
 {
     struct retro_device_power power;
@@ -593,6 +598,7 @@ PUBLIC_SYMBOL void retro_set_environment(retro_environment_t cb) {
 
         if (vfs.required_interface_version >= FILESTREAM_REQUIRED_VFS_VERSION) {
             filestream_vfs_init(&vfs);
+            retro::_usesFrontendVfs = true;
         }
 
         if (vfs.required_interface_version >= DIRENT_REQUIRED_VFS_VERSION) {
@@ -72,6 +72,10 @@ namespace retro {
     std::optional<std::string> username() noexcept;
     void set_option_visible(const char* key, bool visible) noexcept;
     bool supports_power_status() noexcept;
+
+    /// True if the frontend provided its own file streams through RETRO_ENVIRONMENT_GET_VFS_INTERFACE,
+    /// in which case an open file's VFS handle belongs to the frontend.
+    bool uses_frontend_vfs() noexcept;
     std::optional<retro_device_power> get_device_power() noexcept;
 
     bool supports_bitmasks();
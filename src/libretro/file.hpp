@@ -17,6 +17,9 @@
 #ifndef MELONDS_DS_FILE_HPP
 #define MELONDS_DS_FILE_HPP
 
+#include <atomic>
+#include <cstddef>
+
 #include <Platform.h>
 #include <streams/file_stream.h>
 
@@ -25,12 +28,45 @@
 struct Platform::FileHandle {
     RFILE *file;
     unsigned hints;
+
+    /// The host OS's descriptor for this file, or -1 if it was opened by the frontend's VFS.
+    /// Used to sync and map the file without going through the stream.
+    int fd = -1;
+
+    /// Set whenever a frequently-accessed file is written to,
+    /// and cleared once it's been handed off to be synced to disk.
+    /// Only touched on the main thread.
+    bool dirty = false;
+
+    /// Frames until this file is synced to disk, if it's dirty.
+    /// Restarts with each write, so that a burst of writes results in a single sync.
+    int timeUntilFlush = 0;
+
+    /// True from the moment this file is queued for a sync until the sync thread is done with it.
+    std::atomic_bool syncPending = false;
+
+    /// The next file in the sync thread's queue.
+    FileHandle* nextPendingSync = nullptr;
+
+    /// If not null, the file's contents are mapped into memory here,
+    /// and reads and writes are served from the mapping instead of the stream.
+    u8* mapped = nullptr;
+    size_t mappedLength = 0;
+
+    /// The file position, while the file is mapped.
+    u64 mappedPosition = 0;
 };
 
 namespace melonds::file {
     void init();
     void deinit();
 
+    /// Forces the contents of the file at the given path to the host disk,
+    /// e.g. before renaming it over the file it replaces.
+    /// Safe to call from any thread.
+    /// \returns false if the file couldn't be opened or synced.
+    bool Sync(const char* path) noexcept;
+
     [[deprecated("Each kind of file will get its own flush task")]]
     retro::task::TaskSpec FlushTask() noexcept;
 }
@@ -47,6 +47,7 @@ namespace melonds {
         [[nodiscard]] bool ToggleLidDown() const noexcept { return toggleLidButton; }
         [[nodiscard]] bool ToggleLidPressed() const noexcept { return toggleLidButton && !previousToggleLidButton; }
         [[nodiscard]] bool ToggleLidReleased() const noexcept { return !toggleLidButton && previousToggleLidButton; }
+        [[nodiscard]] bool RewindDown() const noexcept { return rewindButton; }
         [[nodiscard]] unsigned MaxCursorTimeout() const noexcept { return maxCursorTimeout;}
         void SetMaxCursorTimeout(unsigned timeout) noexcept {
             if (timeout != maxCursorTimeout) dirty = true;
@@ -78,6 +79,7 @@ namespace melonds {
         bool micButton;
         bool cycleLayoutButton;
         bool previousCycleLayoutButton;
+        bool rewindButton;
 
     };
 
@@ -33,6 +33,7 @@
 #include <streams/rzip_stream.h>
 
 #include <DSi.h>
+#include <DSi_DSP.h>
 #include <DSi_I2C.h>
 #include <frontend/FrontendUtil.h>
 #include <GBACart.h>
@@ -43,6 +44,7 @@
 #include <SPI.h>
 #include <SPU.h>
 
+#include "audio.hpp"
 #include "config.hpp"
 #include "content.hpp"
 #include "dsi.hpp"
@@ -52,12 +54,17 @@
 #include "info.hpp"
 #include "input.hpp"
 #include "memory.hpp"
-#include "microphone.hpp"
+#include "mic.hpp"
 #include "opengl.hpp"
 #include "power.hpp"
 #include "render.hpp"
+#include "retro/microphone.hpp"
 #include "retro/task_queue.hpp"
+#include "rewind.hpp"
+#include "savestate.hpp"
 #include "screenlayout.hpp"
+#include "statebuffer.hpp"
+#include "statehash.hpp"
 #include "sram.hpp"
 #include "tracy.hpp"
 
@@ -72,10 +79,19 @@ namespace melonds {
     static bool mic_state_toggled = false;
     static bool isInDeinit = false;
     static bool isUnloading = false;
+    static bool isSpeculating = false;
     static bool deferred_initialization_pending = false;
     static bool first_frame_run = false;
+
+    // True from when a game is loaded until its first frame, which resumes from its auto-save state (if any).
+    // Unlike first_frame_run, retro_reset doesn't set this again; resetting shouldn't undo itself.
+    static bool resume_auto_save_state = false;
+
     static std::unique_ptr<NdsCart> _loaded_nds_cart;
     static std::unique_ptr<GbaCart> _loaded_gba_cart;
+
+    // The real state of the emulator while run-ahead is showing a future frame
+    static StateBuffer run_ahead_state;
     static const char *const INTERNAL_ERROR_MESSAGE =
         "An internal error occurred with melonDS DS. "
         "Please contact the developer with the log file.";
@@ -102,7 +118,7 @@ namespace melonds {
 
     // functions for running games
     static void read_microphone(melonds::InputState& inputState) noexcept;
-    static void render_audio();
+    static bool run_ahead(unsigned frames) noexcept;
 
 
     bool IsUnloadingGame() noexcept
@@ -114,6 +130,11 @@ namespace melonds {
     {
         return isInDeinit;
     }
+
+    bool IsSpeculating() noexcept
+    {
+        return isSpeculating;
+    }
     retro::task::TaskSpec OnScreenDisplayTask() noexcept;
 }
 
@@ -225,8 +246,8 @@ PUBLIC_SYMBOL void retro_get_system_av_info(struct retro_system_av_info *info) {
 
     retro_assert(melonds::render::CurrentRenderer() != melonds::Renderer::None);
 
-    info->timing.fps = 32.0f * 1024.0f * 1024.0f / 560190.0f;
-    info->timing.sample_rate = 32.0f * 1024.0f;
+    info->timing.fps = melonds::audio::FPS;
+    info->timing.sample_rate = melonds::audio::OutputSampleRate();
     info->geometry = screenLayout.Geometry(melonds::render::CurrentRenderer());
 }
 
@@ -270,32 +291,22 @@ PUBLIC_SYMBOL [[gnu::hot]] void retro_run(void) {
 
         if (!first_frame_run) {
             using namespace sram;
-            // Apply the save data from the core's SRAM buffer to the cart's SRAM;
-            // we need to do this in the first frame of retro_run because
-            // retro_get_memory_data is used to copy the loaded SRAM
-            // in between retro_load and the first retro_run call.
-
             // Nintendo DS SRAM is loaded by the frontend
-            // and copied into NdsSaveManager via the pointer returned by retro_get_memory.
-            // This is where we install the SRAM data into the emulated DS.
-            if (retro::content::get_loaded_nds_info() && NdsSaveManager && NdsSaveManager->SramLength() > 0) {
-                // If we're loading a NDS game that has SRAM...
-                NDS::LoadSave(NdsSaveManager->Sram(), NdsSaveManager->SramLength());
-            }
+            // into our copy of the cart's save memory via the pointer returned by retro_get_memory,
+            // in between retro_load and the first retro_run call.
+            // The cart needs to be given that save data.
+            LoadNdsSave();
 
-            // GBA SRAM is selected by the user explicitly (due to libretro limits) and loaded by the frontend,
-            // but is not processed by retro_get_memory (again due to libretro limits).
-            if (retro::content::get_loaded_nds_info() && GbaSaveManager && GbaSaveManager->SramLength() > 0) {
-                // If we're loading a GBA game that has existing SRAM...
-                // TODO: Decide what to do about SRAM files that append extra metadata like the RTC
-                GBACart::LoadSave(GbaSaveManager->Sram(), GbaSaveManager->SramLength());
+            const optional<retro_game_info>& nds_info = retro::content::get_loaded_nds_info();
+            if (resume_auto_save_state && nds_info) {
+                // If the last session left an auto-save state behind (and auto-save states are on), resume from it
+                savestate::LoadAutoSaveState(*nds_info);
             }
+            resume_auto_save_state = false;
 
-            // We could've installed the GBA's SRAM in retro_load_game (since it's not processed by retro_get_memory),
-            // but doing so here helps keep things tidier since the NDS SRAM is installed here too.
-
-            // This has to be deferred even if we're not using OpenGL,
-            // because libretro doesn't set the SRAM until after retro_load_game
+            // GBA SRAM is selected by the user explicitly (due to libretro limits),
+            // and is read by the core directly into the GBA cart's save memory when the game is loaded.
+            // TODO: Decide what to do about SRAM files that append extra metadata like the RTC
             first_frame_run = true;
         }
 
@@ -326,6 +337,15 @@ PUBLIC_SYMBOL [[gnu::hot]] void retro_run(void) {
                 melonds::opengl::RequestOpenGlRefresh();
             }
 
+            if (rewind::Enabled()) {
+                if (input_state.RewindDown()) {
+                    // If the player is rewinding, go back a frame (and then re-run it so that there's something to show)
+                    rewind::Step();
+                } else {
+                    rewind::Capture();
+                }
+            }
+
             // NDS::RunFrame renders the Nintendo DS state to a framebuffer,
             // which is then drawn to the screen by melonds::render::Render
             {
@@ -333,8 +353,24 @@ PUBLIC_SYMBOL [[gnu::hot]] void retro_run(void) {
                 NDS::RunFrame();
             }
 
+            bool ran_ahead = false;
+            if (unsigned frames = config::savestate::RunAheadFrames(); frames > 0) {
+                // If run-ahead is enabled, show a frame from the near future instead of the one we just ran
+                ran_ahead = run_ahead(frames);
+            }
+
             render::Render(input_state, screenLayout);
-            melonds::render_audio();
+            melonds::audio::Render();
+
+            if (ran_ahead) {
+                // Go back to the real frame, so that the next one is run from there
+                ZoneScopedN("melonds::run_ahead::Restore");
+                if (!run_ahead_state.Load()) {
+                    retro::error("Failed to restore the state saved for run-ahead");
+                }
+            }
+
+            statehash::Trace();
 
             retro::task::check();
         }
@@ -381,50 +417,43 @@ static void melonds::read_microphone(melonds::InputState& inputState) noexcept {
     }
 
     if (retro::microphone::is_open()) {
-        // TODO: Don't set constantly, only when the mic button state changes (or when the input mode is set to Always)
+        // Only reaches the frontend when the mic button state actually changes
         retro::microphone::set_state(should_mic_be_on);
     }
 
-    switch (mic_input_mode) {
-        case MicInputMode::WhiteNoise: // random noise
-        {
-            s16 tmp[735];
-            for (int i = 0; i < 735; i++) tmp[i] = rand() & 0xFFFF;
-            NDS::MicInputFrame(tmp, 735);
-            break;
-        }
-        case MicInputMode::BlowNoise: // blow noise
-        {
-            Frontend::Mic_FeedNoise(); // despite the name, this feeds a blow noise
-            break;
-        }
-        case MicInputMode::HostMic: // microphone input
-        {
-            // TODO: Consider switching to Mic_FeedExternalBuffer
-            const auto mic_state = retro::microphone::get_state();
-            if (mic_state.has_value() && mic_state.value()) {
-                // If the microphone is open and turned on...
-                s16 samples[735];
-                retro::microphone::read(samples, ARRAY_SIZE(samples));
-                NDS::MicInputFrame(samples, ARRAY_SIZE(samples));
-                break;
-            }
-            // If the mic isn't available, feed silence instead
-        }
-        // Intentional fall-through
-        default:
-            Frontend::Mic_FeedSilence();
-    }
+    mic::Feed(mic_input_mode);
 }
 
-static void melonds::render_audio() {
-    ZoneScopedN("melonds::render_audio");
-    static int16_t audio_buffer[0x1000]; // 4096 samples == 2048 stereo frames
-    u32 size = std::min(SPU::GetOutputSize(), static_cast<int>(sizeof(audio_buffer) / (2 * sizeof(int16_t))));
-    // Ensure that we don't overrun the buffer
+// Saves the current (real) state, then emulates the given number of frames past it
+// so that the last of them can be shown in its place.
+// Returns true if the real state must be restored once that frame has been shown.
+static bool melonds::run_ahead(unsigned frames) noexcept {
+    ZoneScopedN("melonds::run_ahead");
+    if (config::system::ConsoleType() == ConsoleType::DSi && DSi_DSP::IsRstReleased()) {
+        // If a DSi game is using the DSP, just show the real frame;
+        // melonDS doesn't save the DSP core's own state, so restoring couldn't take it back
+        return false;
+    }
+
+    if (!run_ahead_state.Save()) {
+        // If savestates aren't supported right now, just show the real frame
+        return false;
+    }
+
+    // The real frame's audio is the only audio that will actually be heard
+    melonds::audio::Drain();
+
+    // These frames will be rolled back, so they mustn't touch the SD card image, firmware, or save files
+    isSpeculating = true;
+    for (unsigned i = 0; i < frames; ++i) {
+        ZoneScopedN("NDS::RunFrame");
+        NDS::RunFrame();
+    }
+    isSpeculating = false;
 
-    size_t read = SPU::ReadOutput(audio_buffer, size);
-    retro::audio_sample_batch(audio_buffer, read);
+    // The frames we ran ahead will be run again for real later, audio and all
+    SPU::DrainOutput();
+    return true;
 }
 
 namespace NDS {
@@ -460,6 +489,15 @@ PUBLIC_SYMBOL void retro_unload_game(void) {
 
     melonds::_loaded_nds_cart.reset();
     melonds::_loaded_gba_cart.reset();
+    melonds::sram::ClearNdsSave(); // Frees our copy of the save data; the frontend has already saved it
+    melonds::sram::ClearGbaSave(); // The save memory was freed along with the cart; the flush task's cleanup already wrote it out
+    melonds::resume_auto_save_state = false;
+    melonds::audio::Reset(); // Also closes the audio capture file, if any
+    melonds::render::ResetCapture();
+    melonds::clear_memory_config(); // The next game's carts will need a different savestate size
+    melonds::rewind::Reset();
+    melonds::run_ahead_state.Clear();
+    melonds::statehash::Reset(); // Also closes the state hash trace, if any
     melonds::isUnloading = false;
 }
 
@@ -490,6 +528,7 @@ PUBLIC_SYMBOL void retro_deinit(void) {
     melonds::_loaded_gba_cart.reset();
     Platform::DeInit();
     melonds::sram::deinit();
+    melonds::savestate::deinit();
     melonds::mic_state_toggled = false;
     melonds::isUnloading = false;
     melonds::deferred_initialization_pending = false;
@@ -519,6 +558,8 @@ PUBLIC_SYMBOL void retro_reset(void) {
     }
 
     melonds::first_frame_run = false;
+    melonds::audio::Reset();
+    melonds::render::ResetCapture();
 
     const auto &nds_info = retro::content::get_loaded_nds_info();
     if (nds_info && melonds::_loaded_nds_cart && !melonds::_loaded_nds_cart->GetHeader().IsDSiWare()) {
@@ -556,6 +597,9 @@ static void melonds::load_games(
 ) {
     ZoneScopedN("melonds::load_games");
     melonds::clear_memory_config();
+    melonds::audio::Reset();
+    melonds::mic::Reset();
+    melonds::rewind::Reset();
     NDSHeader header;
     if (nds_info) {
         // Need to get the header before parsing the ROM,
@@ -565,6 +609,9 @@ static void melonds::load_games(
     }
     melonds::InitConfig(nds_info, nds_info ? make_optional(header) : nullopt, screenLayout, input_state);
 
+    // The sample rate is reported with the AV info after the game is loaded, and can't change until the next one
+    melonds::audio::SetOutputSampleRate(config::audio::OutputSampleRate());
+
     Platform::Init(0, nullptr);
 
     if (retro::supports_power_status())
@@ -619,6 +666,12 @@ static void melonds::load_games(
 
     retro::task::push(sram::FlushFirmwareTask(config::system::EffectiveFirmwarePath()));
 
+    if (nds_info) {
+        // The task itself checks whether auto-save states are enabled, since that can change at any time
+        retro::task::push(savestate::AutoSaveStateTask(*nds_info));
+        resume_auto_save_state = true;
+    }
+
     if (!config::system::ExternalBiosEnable() && _loaded_gba_cart) {
         // If we're using FreeBIOS and are trying to load a GBA cart...
         retro::set_warn_message(
@@ -832,6 +885,16 @@ retro::task::TaskSpec melonds::OnScreenDisplayTask() noexcept {
             text += "Closed";
         }
 
+        if (config::osd::ShowAudioBufferState()) {
+            if (!text.empty()) {
+                text += OSD_DELIMITER;
+            }
+
+            audio::AudioMetrics metrics = audio::Metrics();
+            text += "Audio: " + to_string(metrics.RingFill) + "/" + to_string(metrics.RingCapacity);
+            text += ", " + to_string(metrics.Underruns) + " underruns";
+        }
+
         if (!text.empty()) {
             retro_message_ext message {
                 .msg = text.c_str(),
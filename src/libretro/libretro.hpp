@@ -38,6 +38,11 @@ using GbaCart = GBACart::CartCommon;
 namespace melonds {
     bool IsUnloadingGame() noexcept;
     bool IsInDeinit() noexcept;
+
+    /// True while run-ahead is emulating frames that will be thrown away.
+    /// Anything that would write to the host while this is set should skip the write;
+    /// the real frames will make the same writes once they're run.
+    bool IsSpeculating() noexcept;
 }
 
 #endif //MELONDS_DS_LIBRETRO_HPP
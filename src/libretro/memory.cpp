@@ -17,6 +17,7 @@
 #include "memory.hpp"
 
 #include <cstring>
+#include <vector>
 #include <NDS.h>
 #include <NDSCart.h>
 #include <ARCodeFile.h>
@@ -28,18 +29,39 @@
 #include <retro_assert.h>
 
 #include "tracy.hpp"
+#include "savestate.hpp"
 #include "sram.hpp"
 
 constexpr size_t DS_MEMORY_SIZE = 0x400000;
 constexpr size_t DSI_MEMORY_SIZE = 0x1000000;
 constexpr ssize_t SAVESTATE_SIZE_UNKNOWN = -1;
 
+// Covers the small sections whose size depends on the cart type
+// (e.g. whether a GBA cart is inserted at all), so that they don't need to be measured.
+constexpr size_t SAVESTATE_SLACK = 64 * 1024;
+
 namespace AREngine {
     extern void RunCheat(ARCode &arcode);
 }
 
 namespace melonds {
     static ssize_t _savestate_size = SAVESTATE_SIZE_UNKNOWN;
+
+    // The size of a savestate without any cart save data, or 0 if melonDS can't serialize the emulated console.
+    // It only depends on the emulated hardware, so we only need to measure it once per game.
+    static ssize_t _savestate_base_size = SAVESTATE_SIZE_UNKNOWN;
+
+    // The most that an uncompressed savestate can need;
+    // _savestate_size also leaves room for the compressed container's worst case,
+    // so that turning compression on or off doesn't change the size we report.
+    // Unlike _savestate_size, this isn't 0 in DSi mode, since the core's own run-ahead can still use DSi states.
+    static ssize_t _savestate_raw_size = SAVESTATE_SIZE_UNKNOWN;
+
+    // Uncompressed states pass through here on their way into or out of a compressed container
+    static std::vector<u8> _savestate_staging;
+
+    static size_t cart_save_size() noexcept;
+    static size_t measure_savestate_base_size() noexcept;
 }
 
 static const char *memory_type_name(unsigned type)
@@ -60,26 +82,30 @@ static const char *memory_type_name(unsigned type)
     }
 }
 
-/// Savestates in melonDS can vary in size depending on the game,
-/// so we have to try saving the state first before we can know how big it'll be.
+/// Savestates in melonDS only vary in size by the cart save data they contain,
+/// so we report an upper bound based on the loaded carts' save sizes.
+/// The bound stays the same until the next game is loaded, as frontends expect.
 PUBLIC_SYMBOL size_t retro_serialize_size(void) {
     ZoneScopedN("retro_serialize_size");
     using namespace melonds;
     if (melonds::_savestate_size < 0) {
         // If we haven't yet figured out how big the savestate should be...
+        size_t raw_size = uncompressed_savestate_size();
 
         if (config::system::ConsoleType() == ConsoleType::DSi) {
-            // DSi mode doesn't support savestates right now
+            // DSi states can only be used by the core's own run-ahead, whose speculative frames don't write to the host.
+            // The emulated DSi writes straight to the NAND and SD card images on the host,
+            // so loading any other state (or rewinding) would leave it behind what's on those images.
+            melonds::_savestate_size = 0;
+        } else if (raw_size == 0) {
+            // If melonDS couldn't serialize the emulated console...
             melonds::_savestate_size = 0;
-            // TODO: When DSi mode supports savestates, remove this conditional block
         } else {
-            Savestate state;
-            NDS::DoSavestate(&state);
-            melonds::_savestate_size = state.Length();
+            melonds::_savestate_size = savestate::MaxCompressedSize(raw_size);
 
             retro::log(
                 RETRO_LOG_INFO,
-                "Savestate requires %dB = %.0fKiB = %.0fMiB (before compression)",
+                "Savestate requires at most %dB = %.0fKiB = %.0fMiB (before compression)",
                 melonds::_savestate_size,
                 melonds::_savestate_size / 1024.0f,
                 melonds::_savestate_size / 1024.0f / 1024.0f
@@ -92,20 +118,103 @@ PUBLIC_SYMBOL size_t retro_serialize_size(void) {
 
 PUBLIC_SYMBOL bool retro_serialize(void *data, size_t size) {
     ZoneScopedN("retro_serialize");
-    memset(data, 0, size);
+    using namespace melonds;
+
+    if (!config::savestate::CompressSavestates() || savestate::IsFastSavestate()) {
+        // If compression is off, or if this state is for run-ahead (which needs speed, not space)...
+        return serialize_uncompressed(data, size);
+    }
+
+    if (uncompressed_savestate_size() == 0) {
+        // If savestates aren't supported right now, let the usual error handling deal with it
+        return serialize_uncompressed(data, size);
+    }
+
+    _savestate_staging.resize(_savestate_raw_size);
+    if (!serialize_uncompressed(_savestate_staging.data(), _savestate_staging.size())) {
+        return false;
+    }
+
+    size_t length = savestate::Compress(_savestate_staging.data(), _savestate_staging.size(), static_cast<u8*>(data), size);
+    if (length == 0) {
+        // If compression failed for any reason, the frontend still gets a usable state
+        return serialize_uncompressed(data, size);
+    }
+
+    memset(static_cast<u8*>(data) + length, 0, size - length);
+    return true;
+}
+
+bool melonds::serialize_uncompressed(void *data, size_t size) noexcept {
+    ZoneScopedN("melonds::serialize_uncompressed");
 
     Savestate state(data, size, true);
+    if (!NDS::DoSavestate(&state) || state.Error) {
+        // If the state didn't fit in the bound we reported (or failed for some other reason)...
+        retro::error("Failed to serialize a %zuB savestate into a %zuB buffer", static_cast<size_t>(state.Length()), size);
+
+        // Measure again next time, in case our estimate was wrong
+        melonds::_savestate_size = SAVESTATE_SIZE_UNKNOWN;
+        melonds::_savestate_base_size = SAVESTATE_SIZE_UNKNOWN;
+        melonds::_savestate_raw_size = SAVESTATE_SIZE_UNKNOWN;
+        return false;
+    }
+
+    // The frontend's buffer leaves room for compression, so the state could outgrow the bound
+    // that we promised for uncompressed states without failing here; that would break run-ahead and rewind
+    size_t length = state.Length();
+    retro_assert(_savestate_raw_size <= 0 || length <= static_cast<size_t>(_savestate_raw_size));
+
+    // Only the unused tail needs to be cleared, so that identical states produce identical buffers
+    if (length < size) {
+        memset(static_cast<u8*>(data) + length, 0, size - length);
+    }
 
-    return NDS::DoSavestate(&state) && !state.Error;
+    return true;
+}
+
+size_t melonds::uncompressed_savestate_size() noexcept {
+    if (_savestate_raw_size < 0) {
+        // If we haven't yet figured out how big the savestate should be...
+        if (_savestate_base_size < 0) {
+            // If this is the first time we've needed a savestate for this game...
+            _savestate_base_size = measure_savestate_base_size();
+        }
+
+        _savestate_raw_size = _savestate_base_size > 0 ? _savestate_base_size + cart_save_size() + SAVESTATE_SLACK : 0;
+    }
+
+    return _savestate_raw_size;
 }
 
 PUBLIC_SYMBOL bool retro_unserialize(const void *data, size_t size) {
     ZoneScopedN("retro_unserialize");
     retro::log(RETRO_LOG_DEBUG, "retro_unserialize(%p, %d)", data, size);
 
+    if (retro_serialize_size() == 0) {
+        // If savestates aren't available to the frontend (e.g. in DSi mode)...
+        retro::error("Savestates aren't available right now");
+        return false;
+    }
+
+    if (melonds::savestate::IsCompressed(data, size)) {
+        // If this state was compressed by retro_serialize...
+        size_t max_size = melonds::uncompressed_savestate_size();
+        if (!melonds::savestate::Decompress(data, size, max_size, melonds::_savestate_staging)) {
+            return false;
+        }
+
+        data = melonds::_savestate_staging.data();
+        size = melonds::_savestate_staging.size();
+    }
+
     Savestate savestate((u8 *) data, size, false);
+    bool loaded = NDS::DoSavestate(&savestate) && !savestate.Error;
 
-    return NDS::DoSavestate(&savestate) && !savestate.Error;
+    // Even a failed load may have gotten as far as the carts
+    melonds::sram::RefreshSaveMemory();
+    melonds::sram::SyncNdsSave();
+    return loaded;
 }
 
 PUBLIC_SYMBOL void *retro_get_memory_data(unsigned type) {
@@ -114,10 +223,9 @@ PUBLIC_SYMBOL void *retro_get_memory_data(unsigned type) {
         case RETRO_MEMORY_SYSTEM_RAM:
             return NDS::MainRAM;
         case RETRO_MEMORY_SAVE_RAM:
-            if (melonds::sram::NdsSaveManager) {
-                return melonds::sram::NdsSaveManager->Sram();
-            }
-            [[fallthrough]];
+            // The frontend caches this pointer, so it's our own copy of the cart's save memory
+            // (which a savestate can replace) rather than the cart's.
+            return melonds::sram::NdsSaveData();
         default:
             return nullptr;
     }
@@ -140,10 +248,7 @@ PUBLIC_SYMBOL size_t retro_get_memory_size(unsigned type) {
                     return DSI_MEMORY_SIZE; // 16MB, the size of the DSi system RAM
             }
         case RETRO_MEMORY_SAVE_RAM:
-            if (melonds::sram::NdsSaveManager) {
-                return melonds::sram::NdsSaveManager->SramLength();
-            }
-            [[fallthrough]];
+            return melonds::sram::NdsSaveLength();
         default:
             return 0;
     }
@@ -173,4 +278,26 @@ PUBLIC_SYMBOL void retro_cheat_set(unsigned index, bool enabled, const char *cod
 
 void melonds::clear_memory_config() {
     _savestate_size = SAVESTATE_SIZE_UNKNOWN;
+    _savestate_base_size = SAVESTATE_SIZE_UNKNOWN; // The next game may run on different emulated hardware (e.g. DS vs. DSi)
+    _savestate_raw_size = SAVESTATE_SIZE_UNKNOWN;
+    std::vector<u8>().swap(_savestate_staging);
+}
+
+static size_t melonds::cart_save_size() noexcept {
+    return sram::NdsSaveLength() + sram::GbaSaveLength();
+}
+
+// Serializes the current state once, then subtracts the cart save data it contains
+static size_t melonds::measure_savestate_base_size() noexcept {
+    ZoneScopedN("melonds::measure_savestate_base_size");
+    Savestate state;
+    if (!NDS::DoSavestate(&state) || state.Error) {
+        retro::error("Failed to serialize the emulated console; savestates won't be available");
+        return 0;
+    }
+
+    size_t length = state.Length();
+    size_t saves = cart_save_size();
+
+    return length > saves ? length - saves : length;
 }
\ No newline at end of file
@@ -32,6 +32,16 @@ namespace melonds {
 
     void clear_memory_config();
 
+    /// Serializes the emulator state as-is, regardless of the compression settings.
+    /// Pads the rest of the buffer with zeroes, so identical states produce identical buffers.
+    bool serialize_uncompressed(void* data, size_t size) noexcept;
+
+    /// The most space that an uncompressed savestate can need right now,
+    /// or 0 if melonDS can't serialize the emulated console.
+    /// Unlike retro_serialize_size, this isn't 0 in DSi mode,
+    /// since states that never leave the core (e.g. for run-ahead) still work there.
+    [[nodiscard]] size_t uncompressed_savestate_size() noexcept;
+
 
 }
 #endif //MELONDS_DS_MEMORY_HPP
@@ -0,0 +1,274 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include "mic.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <frontend/FrontendUtil.h>
+#include <NDS.h>
+
+#include "audio.hpp"
+#include "config.hpp"
+#include "environment.hpp"
+#include "retro/microphone.hpp"
+#include "tracy.hpp"
+
+namespace melonds::mic {
+    // melonDS assumes that the mic is sampled at 44.1kHz and that the console runs at 60fps,
+    // so NDS::MicInputFrame wants 735 samples per frame
+    constexpr unsigned NDS_MIC_RATE = 44100;
+    constexpr size_t SAMPLES_PER_FRAME = 735;
+
+    // Host samples that haven't been resampled yet.
+    // Sized for the host mic's rate when the stream starts, always to a power of two so that indices can be masked;
+    // this is just the smallest size it can have.
+    constexpr size_t MIN_HOST_RING_CAPACITY = 4096;
+    static std::vector<int16_t> _hostRing;
+    static size_t _hostRingMask = 0;
+    static size_t _hostRead = 0;
+    static size_t _hostWrite = 0;
+    static std::vector<int16_t> _readBuffer;
+
+    // Given to Frontend::Mic_SetExternalBuffer, which reads SAMPLES_PER_FRAME samples per frame from it
+    // and wraps around at the end; we fill in each segment just before it's read
+    constexpr size_t EXTERNAL_SEGMENTS = 2;
+    static std::array<int16_t, SAMPLES_PER_FRAME * EXTERNAL_SEGMENTS> _externalBuffer;
+    static size_t _segment = 0;
+
+    static bool _streaming = false;
+
+    // Fractional read position into the host ring, and how far it advances per NDS sample
+    static double _position = 0;
+    static double _step = 1.0;
+
+    // How far the read position advances per NDS sample this frame,
+    // nudged away from _step to soak up clock drift between the host mic and the emulated console
+    static double _frameStep = 1.0;
+
+    // How many host samples the mic delivers per emulated frame, and how many of those we haven't read yet
+    static double _hostSamplesPerFrame = SAMPLES_PER_FRAME;
+    static double _hostSamplesOwed = 0;
+
+    // How many unread host samples to keep around beyond what the next frame needs,
+    // so that a late delivery doesn't have to be padded with silence
+    constexpr double HOST_CUSHION = 128;
+
+    // The most that the resampling ratio is allowed to stray from the nominal one
+    constexpr double MAX_DRIFT_CORRECTION = 0.005;
+
+    // Enough white noise to start each frame's worth at a different offset
+    constexpr size_t NOISE_TABLE_SIZE = 4096;
+    static std::array<int16_t, NOISE_TABLE_SIZE + SAMPLES_PER_FRAME> _noiseTable;
+    static bool _noiseTableReady = false;
+    static uint32_t _noiseOffset = 0;
+
+    static void FeedHostMic() noexcept;
+    static void FeedWhiteNoise() noexcept;
+    static void StartStream() noexcept;
+    static void SizeHostRing(unsigned rate) noexcept;
+    static void ReadHostMic() noexcept;
+    static void Resample(int16_t* output) noexcept;
+    static void BuildNoiseTable() noexcept;
+}
+
+void melonds::mic::Feed(MicInputMode mode) noexcept {
+    ZoneScopedN("melonds::mic::Feed");
+    if (mode != MicInputMode::HostMic) {
+        // If we're not streaming from the host mic (anymore)...
+        _streaming = false;
+    }
+
+    switch (mode) {
+        case MicInputMode::WhiteNoise:
+            FeedWhiteNoise();
+            break;
+        case MicInputMode::BlowNoise:
+            Frontend::Mic_FeedNoise(); // despite the name, this feeds a blow noise
+            break;
+        case MicInputMode::HostMic:
+            FeedHostMic();
+            break;
+        default:
+            Frontend::Mic_FeedSilence();
+            break;
+    }
+}
+
+void melonds::mic::Reset() noexcept {
+    _streaming = false;
+    _hostRead = 0;
+    _hostWrite = 0;
+    _position = 0;
+    _hostSamplesOwed = 0;
+}
+
+static void melonds::mic::FeedHostMic() noexcept {
+    ZoneScopedN("melonds::mic::FeedHostMic");
+    std::optional<bool> mic_state = retro::microphone::get_state();
+    if (!mic_state || !*mic_state) {
+        // If the mic isn't available or isn't turned on, feed silence instead
+        _streaming = false;
+        Frontend::Mic_FeedSilence();
+        return;
+    }
+
+    if (!_streaming) {
+        // If the mic was just turned on...
+        StartStream();
+    }
+
+    ReadHostMic();
+    Resample(&_externalBuffer[_segment * SAMPLES_PER_FRAME]);
+    Frontend::Mic_FeedExternalBuffer();
+    _segment = (_segment + 1) % EXTERNAL_SEGMENTS;
+}
+
+static void melonds::mic::StartStream() noexcept {
+    ZoneScopedN("melonds::mic::StartStream");
+    Reset();
+
+    unsigned rate = retro::microphone::get_rate().value_or(NDS_MIC_RATE);
+    _step = static_cast<double>(rate) / NDS_MIC_RATE;
+    _frameStep = _step;
+    _hostSamplesPerFrame = rate / audio::FPS;
+    if (rate != NDS_MIC_RATE) {
+        retro::debug("Resampling microphone input from %uHz to %uHz", rate, NDS_MIC_RATE);
+    }
+    SizeHostRing(rate);
+
+    // Also resets melonDS's read position to the start of the buffer, which matches our first segment
+    _segment = 0;
+    Frontend::Mic_SetExternalBuffer(_externalBuffer.data(), _externalBuffer.size());
+    _streaming = true;
+}
+
+// Makes the host ring big enough for everything that ReadHostMic lets pile up at the given rate:
+// up to twice the backlog target before the excess is dropped, plus up to two frames' worth read in one go.
+// Only allocates when the rate needs a bigger ring than we already have.
+static void melonds::mic::SizeHostRing(unsigned rate) noexcept {
+    double step = static_cast<double>(rate) / NDS_MIC_RATE;
+    double samplesPerFrame = rate / audio::FPS;
+    size_t needed = static_cast<size_t>(std::ceil(2 * (SAMPLES_PER_FRAME * step + HOST_CUSHION) + 2 * samplesPerFrame));
+
+    size_t capacity = MIN_HOST_RING_CAPACITY;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+
+    if (capacity > _hostRing.size()) {
+        ZoneScopedN("melonds::mic::SizeHostRing");
+        _hostRing.assign(capacity, 0);
+        _hostRingMask = capacity - 1;
+        retro::debug("Allocated a %zu-sample ring for %uHz microphone input", capacity, rate);
+    }
+
+    size_t readSize = static_cast<size_t>(std::ceil(samplesPerFrame * 2));
+    if (readSize > _readBuffer.size()) {
+        _readBuffer.assign(readSize, 0);
+    }
+}
+
+// Reads as many host samples as the mic delivers per emulated frame
+// (which is a bit more than one frame's worth at 44.1kHz, since the console runs slower than 60fps),
+// then picks this frame's resampling ratio so that the unread backlog stays near its target.
+// Without this, the difference between the two clocks piles up in the frontend's mic buffer as latency.
+static void melonds::mic::ReadHostMic() noexcept {
+    ZoneScopedN("melonds::mic::ReadHostMic");
+    _hostSamplesOwed = std::min(_hostSamplesOwed + _hostSamplesPerFrame, _hostSamplesPerFrame * 2);
+    size_t wanted = std::min(static_cast<size_t>(_hostSamplesOwed), _readBuffer.size());
+    int read = retro::microphone::read(_readBuffer.data(), wanted).value_or(0);
+    if (read > 0) {
+        for (int i = 0; i < read; ++i) {
+            _hostRing[(_hostWrite + i) & _hostRingMask] = _readBuffer[i];
+        }
+
+        _hostWrite += read;
+        _hostSamplesOwed -= read;
+    }
+
+    double target = SAMPLES_PER_FRAME * _step + HOST_CUSHION;
+    double backlog = static_cast<double>(_hostWrite - _hostRead) - _position;
+    if (backlog > target * 2) {
+        // If the backlog has gotten away from us (e.g. the frontend delivered a burst),
+        // drop the oldest samples instead of taking several seconds to stretch them out
+        size_t excess = static_cast<size_t>(backlog - target);
+        _hostRead += excess;
+        backlog -= excess;
+    }
+
+    double correction = std::clamp((backlog - target) / target, -MAX_DRIFT_CORRECTION, MAX_DRIFT_CORRECTION);
+    _frameStep = _step * (1.0 + correction);
+}
+
+// Linearly interpolates one frame's worth of samples out of the host ring.
+// Any samples that the host didn't deliver in time are filled with silence.
+static void melonds::mic::Resample(int16_t* output) noexcept {
+    ZoneScopedN("melonds::mic::Resample");
+    size_t available = _hostWrite - _hostRead;
+    size_t produced = 0;
+
+    for (; produced < SAMPLES_PER_FRAME; ++produced) {
+        size_t index = static_cast<size_t>(_position);
+        if (index + 1 >= available) {
+            // If we need a sample that the host hasn't delivered yet...
+            break;
+        }
+
+        double t = _position - index;
+        int a = _hostRing[(_hostRead + index) & _hostRingMask];
+        int b = _hostRing[(_hostRead + index + 1) & _hostRingMask];
+        output[produced] = static_cast<int16_t>(std::lround(a + (b - a) * t));
+        _position += _frameStep;
+    }
+
+    std::fill(output + produced, output + SAMPLES_PER_FRAME, 0);
+
+    // Release the samples we've fully passed, keeping the fractional position
+    size_t consumed = std::min(static_cast<size_t>(_position), available);
+    _hostRead += consumed;
+    _position -= consumed;
+}
+
+static void melonds::mic::FeedWhiteNoise() noexcept {
+    if (!_noiseTableReady) {
+        BuildNoiseTable();
+    }
+
+    // Start each frame somewhere else in the table so that the noise doesn't repeat on a short cycle
+    _noiseOffset = _noiseOffset * 1664525u + 1013904223u;
+    NDS::MicInputFrame(&_noiseTable[(_noiseOffset >> 16) % NOISE_TABLE_SIZE], SAMPLES_PER_FRAME);
+}
+
+static void melonds::mic::BuildNoiseTable() noexcept {
+    ZoneScopedN("melonds::mic::BuildNoiseTable");
+
+    // xorshift32; quality doesn't matter here, it just has to sound like noise
+    uint32_t state = 0x2545F491;
+    for (int16_t& sample : _noiseTable) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        sample = static_cast<int16_t>(state & 0xFFFF);
+    }
+
+    _noiseTableReady = true;
+}
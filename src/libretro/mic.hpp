@@ -0,0 +1,35 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef MELONDS_DS_MIC_HPP
+#define MELONDS_DS_MIC_HPP
+
+//! Streams input from the configured source into the emulated microphone.
+
+namespace melonds {
+    enum class MicInputMode;
+}
+
+namespace melonds::mic {
+    /// Feeds one frame's worth of input from the given source to the emulated microphone.
+    /// Should be called once per frame, before NDS::RunFrame.
+    void Feed(MicInputMode mode) noexcept;
+
+    /// Discards any buffered host microphone input.
+    void Reset() noexcept;
+}
+
+#endif //MELONDS_DS_MIC_HPP
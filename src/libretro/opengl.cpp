@@ -17,6 +17,8 @@
 #include "opengl.hpp"
 
 #include <array>
+#include <optional>
+#include <utility>
 #include <gfx/gl_capabilities.h>
 #include <libretro.h>
 #include <glsm/glsm.h>
@@ -25,6 +27,7 @@
 #include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
 #include <GPU.h>
+#include <NDS.h>
 #include <OpenGLSupport.h>
 
 #include "embedded/melondsds_fragment_shader.h"
@@ -39,6 +42,8 @@
 #include "tracy.hpp"
 
 using std::array;
+using std::nullopt;
+using std::optional;
 using glm::ivec2;
 using glm::vec2;
 using glm::vec3;
@@ -80,11 +85,35 @@ namespace melonds::opengl {
     bool refresh_opengl = true;
     static bool context_initialized = false;
     static GLuint shader[3];
-    static GLuint screen_framebuffer_texture;
     static Vertex screen_vertices[18];
     static unsigned vertexCount = 0;
     static GLuint vao, vbo;
 
+    /// The render settings that the 3D renderer was last configured with,
+    /// or nullopt if it must be (re)configured before the next frame.
+    static optional<GPU::RenderSettings> appliedRenderSettings;
+
+    // Async readback of the composed frame.
+    // Each frame is read into a pixel pack buffer and fenced,
+    // then mapped and delivered once the fence has signaled.
+    constexpr unsigned READBACK_RING_SIZE = 3;
+
+    // How long to wait for the oldest readback if the GPU is a whole ring behind;
+    // long enough for any GPU that's still making progress
+    constexpr GLuint64 READBACK_TIMEOUT_NS = 1'000'000'000;
+    struct ReadbackSlot {
+        GLuint pbo;
+        GLsync fence;
+        GLsizeiptr capacity;
+        unsigned width;
+        unsigned height;
+        uint32_t frame;
+    };
+    static array<ReadbackSlot, READBACK_RING_SIZE> readbackSlots;
+    static unsigned readbackNext = 0; // The slot that the next frame will be read into
+    static unsigned readbackPending = 0; // How many slots are waiting on the GPU
+    static ReadbackCallback readbackCallback;
+
     static struct {
         vec2 uScreenSize;
         u32 u3DScale;
@@ -101,7 +130,15 @@ namespace melonds::opengl {
     static void SetupOpenGl();
 
     static void InitializeFrameState(const ScreenLayoutData& screenLayout) noexcept;
+    static bool RendererNeedsRebuild(const GPU::RenderSettings& settings) noexcept;
     static void InitializeVertices(const ScreenLayoutData& screenLayout) noexcept;
+
+    static void SetupReadback() noexcept;
+    static void QueueReadback(unsigned width, unsigned height) noexcept;
+    static void DeliverReadbacks(bool waitForOldest) noexcept;
+    static void DiscardReadbacks() noexcept;
+    static void DestroyReadback() noexcept;
+    static void FinishReadbacks() noexcept;
 }
 
 constexpr unsigned GetVertexCount(ScreenLayout layout, melonds::HybridSideScreenDisplay hybridScreen) noexcept {
@@ -218,6 +255,12 @@ void melonds::opengl::Render(const InputState& state, const ScreenLayoutData& sc
     glBindVertexArray(vao);
     glDrawArrays(GL_TRIANGLES, 0, vertexCount);
 
+    if (readbackCallback) {
+        // If some part of the core wants to see the composed frame...
+        DeliverReadbacks(false);
+        QueueReadback(screenLayout.BufferWidth(), screenLayout.BufferHeight());
+    }
+
     glFlush();
 
     glsm_ctl(GLSM_CTL_STATE_UNBIND, nullptr);
@@ -235,6 +278,7 @@ void melonds::opengl::deinitialize() {
     retro::log(RETRO_LOG_DEBUG, "melonds::opengl::deinitialize()");
     GPU::DeInitRenderer();
     GPU::InitRenderer(false);
+    appliedRenderSettings = nullopt;
 }
 
 static void melonds::opengl::ContextReset() noexcept try {
@@ -255,6 +299,7 @@ static void melonds::opengl::ContextReset() noexcept try {
     glsm_ctl(GLSM_CTL_STATE_BIND, nullptr);
 
     GPU::InitRenderer(static_cast<int>(melonds::render::CurrentRenderer()));
+    appliedRenderSettings = nullopt; // The renderer was just rebuilt, so it'll need its settings again
 
     SetupOpenGl();
     context_initialized = true;
@@ -288,10 +333,14 @@ static void melonds::opengl::context_destroy() {
     ZoneScopedN("melonds::opengl::context_destroy");
     retro::log(RETRO_LOG_DEBUG, "melonds::opengl::context_destroy()");
     glsm_ctl(GLSM_CTL_STATE_BIND, nullptr);
-    glDeleteTextures(1, &screen_framebuffer_texture);
 
     glDeleteVertexArrays(1, &vao);
     glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ubo);
+
+    // Hand the callback the last few frames before their buffers go away
+    FinishReadbacks();
+    DestroyReadback();
 
     OpenGL::DeleteShaderProgram(shader);
     glsm_ctl(GLSM_CTL_STATE_UNBIND, nullptr);
@@ -357,17 +406,7 @@ static void melonds::opengl::SetupOpenGl() {
     glEnableVertexAttribArray(1); // texcoord
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * 4, (void *) (2 * 4));
 
-    glGenTextures(1, &screen_framebuffer_texture);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, screen_framebuffer_texture);
-    if (openGlDebugAvailable) {
-        glObjectLabel(GL_TEXTURE, screen_framebuffer_texture, -1, "melonDS DS Screen Texture");
-    }
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8UI, NDS_SCREEN_WIDTH * 3 + 1, NDS_SCREEN_HEIGHT * 2, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+    SetupReadback();
 
     refresh_opengl = true;
 }
@@ -542,7 +581,14 @@ void melonds::opengl::InitializeFrameState(const ScreenLayoutData& screenLayout)
     ZoneScopedN("melonds::opengl::InitializeFrameState");
     refresh_opengl = false;
     GPU::RenderSettings render_settings = melonds::config::video::RenderSettings();
-    GPU::SetRenderSettings(static_cast<int>(Renderer::OpenGl), render_settings);
+    if (RendererNeedsRebuild(render_settings)) {
+        // If the 3D renderer's own resources (e.g. its scaled framebuffers) are affected by the new settings...
+        ZoneScopedN("GPU::SetRenderSettings");
+        GPU::SetRenderSettings(static_cast<int>(Renderer::OpenGl), render_settings);
+        appliedRenderSettings = render_settings;
+    }
+    // Layout changes only need new vertices and uniforms (below),
+    // and the screen filter is applied to the sampler state every frame in Render.
 
     GL_ShaderConfig.uScreenSize = screenLayout.BufferSize();
     GL_ShaderConfig.u3DScale = screenLayout.Scale();
@@ -558,3 +604,163 @@ void melonds::opengl::InitializeFrameState(const ScreenLayoutData& screenLayout)
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(screen_vertices), screen_vertices);
 }
+
+// GPU::SetRenderSettings tears down and rebuilds the OpenGL 3D renderer,
+// so only call it if a setting that the renderer actually uses has changed.
+static bool melonds::opengl::RendererNeedsRebuild(const GPU::RenderSettings& settings) noexcept {
+    if (!appliedRenderSettings) {
+        return true;
+    }
+
+    // Soft_Threaded is ignored by the OpenGL renderer
+    return appliedRenderSettings->GL_ScaleFactor != settings.GL_ScaleFactor
+        || appliedRenderSettings->GL_BetterPolygons != settings.GL_BetterPolygons;
+}
+
+void melonds::opengl::SetReadbackCallback(ReadbackCallback callback) noexcept {
+    readbackCallback = std::move(callback);
+
+    if (!readbackCallback && context_initialized) {
+        // If nobody wants frames anymore, don't hold on to the pending ones
+        glsm_ctl(GLSM_CTL_STATE_BIND, nullptr);
+        DiscardReadbacks();
+        glsm_ctl(GLSM_CTL_STATE_UNBIND, nullptr);
+    }
+}
+
+// Waits for and delivers every pending readback. The context must be bound.
+static void melonds::opengl::FinishReadbacks() noexcept {
+    ZoneScopedN("melonds::opengl::FinishReadbacks");
+    if (!readbackCallback) {
+        return;
+    }
+
+    while (readbackPending > 0) {
+        unsigned pending = readbackPending;
+        DeliverReadbacks(true);
+        if (readbackPending == pending) {
+            // If the GPU hung...
+            break;
+        }
+    }
+}
+
+void melonds::opengl::FlushReadbacks() noexcept {
+    if (!context_initialized || readbackPending == 0) {
+        return;
+    }
+
+    glsm_ctl(GLSM_CTL_STATE_BIND, nullptr);
+    FinishReadbacks();
+    glsm_ctl(GLSM_CTL_STATE_UNBIND, nullptr);
+}
+
+static void melonds::opengl::SetupReadback() noexcept {
+    ZoneScopedN("melonds::opengl::SetupReadback");
+    readbackNext = 0;
+    readbackPending = 0;
+    for (ReadbackSlot& slot : readbackSlots) {
+        slot = {};
+        glGenBuffers(1, &slot.pbo);
+        if (openGlDebugAvailable) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            glObjectLabel(GL_BUFFER, slot.pbo, -1, "melonDS DS Readback Buffer");
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    // Buffer storage is allocated lazily in QueueReadback, once we know the framebuffer size
+}
+
+// Must be called after the frame is drawn, while the output framebuffer is still bound
+static void melonds::opengl::QueueReadback(unsigned width, unsigned height) noexcept {
+    ZoneScopedN("melonds::opengl::QueueReadback");
+    if (readbackPending == READBACK_RING_SIZE) {
+        // If the GPU hasn't finished any of the previous readbacks...
+        // Wait for the oldest one instead of dropping this frame, since consumers (e.g. capture) need every frame.
+        // The GPU is already three frames behind at this point, so this stall is the pipeline's, not ours.
+        DeliverReadbacks(true);
+    }
+
+    if (readbackPending == READBACK_RING_SIZE) {
+        // If the GPU still hasn't finished (e.g. it hung)...
+        retro::warn("GPU is too far behind; dropping a %ux%u readback", width, height);
+        return;
+    }
+
+    ReadbackSlot& slot = readbackSlots[readbackNext];
+    retro_assert(slot.fence == nullptr);
+
+    GLsizeiptr size = static_cast<GLsizeiptr>(width) * height * sizeof(uint32_t);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    if (slot.capacity < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        slot.capacity = size;
+    }
+
+    // With a pack buffer bound, glReadPixels only enqueues the copy instead of waiting for it
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+    // Unbind the pack buffer so that the frontend's own glReadPixels calls don't write into it
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.width = width;
+    slot.height = height;
+    slot.frame = NDS::NumFrames;
+    readbackNext = (readbackNext + 1) % READBACK_RING_SIZE;
+    readbackPending++;
+}
+
+// Hands every completed readback to the callback, oldest first.
+// Only blocks if waitForOldest is set, and then only on the oldest readback.
+static void melonds::opengl::DeliverReadbacks(bool waitForOldest) noexcept {
+    ZoneScopedN("melonds::opengl::DeliverReadbacks");
+    while (readbackPending > 0) {
+        unsigned oldest = (readbackNext + READBACK_RING_SIZE - readbackPending) % READBACK_RING_SIZE;
+        ReadbackSlot& slot = readbackSlots[oldest];
+        retro_assert(slot.fence != nullptr);
+
+        GLuint64 timeout = waitForOldest ? READBACK_TIMEOUT_NS : 0;
+        waitForOldest = false;
+        GLenum status = glClientWaitSync(slot.fence, timeout ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            // If the GPU hasn't finished copying this frame yet (or the wait failed)...
+            // Later frames can't be done either, so try again next frame.
+            break;
+        }
+
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        readbackPending--;
+
+        GLsizeiptr size = static_cast<GLsizeiptr>(slot.width) * slot.height * sizeof(uint32_t);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        if (const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT)) {
+            readbackCallback(slot.frame, pixels, slot.width, slot.height, slot.width * sizeof(uint32_t));
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        } else {
+            retro::warn("Failed to map %ux%u readback buffer; dropping frame", slot.width, slot.height);
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+static void melonds::opengl::DiscardReadbacks() noexcept {
+    for (ReadbackSlot& slot : readbackSlots) {
+        if (slot.fence) {
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+    }
+    readbackPending = 0;
+}
+
+static void melonds::opengl::DestroyReadback() noexcept {
+    DiscardReadbacks();
+    for (ReadbackSlot& slot : readbackSlots) {
+        glDeleteBuffers(1, &slot.pbo);
+        slot = {};
+    }
+}
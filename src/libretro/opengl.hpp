@@ -17,12 +17,25 @@
 #ifndef MELONDS_DS_OPENGL_HPP
 #define MELONDS_DS_OPENGL_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
 namespace melonds {
     class InputState;
     class ScreenLayoutData;
 }
 
 namespace melonds::opengl {
+    /// Receives a composed frame that was read back from the GPU.
+    /// \param frame The value of NDS::NumFrames when the frame was drawn.
+    /// \param pixels RGBA8 pixels, with the bottom row first (as per OpenGL convention).
+    /// Only valid for the duration of the call.
+    /// \param width Width of the frame in pixels.
+    /// \param height Height of the frame in pixels.
+    /// \param pitch Length of each row in bytes.
+    using ReadbackCallback = std::function<void(uint32_t frame, const void* pixels, unsigned width, unsigned height, size_t pitch)>;
+
     // Requests that the OpenGL context be refreshed.
 #if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
     void RequestOpenGlRefresh();
@@ -39,8 +52,23 @@ namespace melonds::opengl {
     bool ContextInitialized();
 #if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
     bool UsingOpenGl();
+
+    /// Starts asynchronously reading back each composed frame,
+    /// or stops if \c callback is empty.
+    /// Frames are delivered to \c callback in order from within Render, usually one or two frames after they're drawn.
+    /// Every frame is delivered; if the GPU falls a whole ring of readbacks behind,
+    /// Render waits for the oldest one instead of dropping the new one.
+    /// Pending frames are discarded if the callback is cleared,
+    /// but they're delivered before the context is destroyed.
+    void SetReadbackCallback(ReadbackCallback callback) noexcept;
+
+    /// Waits for every pending readback and delivers it to the callback.
+    /// Does nothing if there's no OpenGL context.
+    void FlushReadbacks() noexcept;
 #else
     inline bool UsingOpenGl() { return false; }
+    inline void SetReadbackCallback(ReadbackCallback) noexcept {}
+    inline void FlushReadbacks() noexcept {}
 #endif
 }
 #endif //MELONDS_DS_OPENGL_HPP
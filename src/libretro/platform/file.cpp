@@ -17,13 +17,22 @@
 #include "file.hpp"
 #define SKIP_STDIO_REDEFINES
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
-#include <memory>
+#include <cinttypes>
+#include <cstdint>
+#include <cstring>
 #include <system_error>
-#include <unordered_map>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include <file/file_path.h>
 #include <Platform.h>
 #include <streams/file_stream.h>
@@ -35,13 +44,29 @@
 
 #include "config.hpp"
 #include "environment.hpp"
+#include "libretro.hpp"
+#include "retro/vfs.hpp"
 #include "tracy.hpp"
 #include "utils.hpp"
 
-using std::unique_ptr;
-using std::unordered_map;
+using std::vector;
+
+// Open files that are synced to disk some time after they're written;
+// only changes when such a file is opened or closed, not when it's written to
+static vector<Platform::FileHandle*> frequentFiles;
+
+// Files waiting to be synced, as a lock-free intrusive stack linked by FileHandle::nextPendingSync.
+// The main thread pushes onto it, and the sync thread takes the whole stack at once.
+static std::atomic<Platform::FileHandle*> pendingSyncs = nullptr;
+static std::atomic_bool stopSyncThread = false;
+static Platform::Semaphore* syncSemaphore = nullptr;
+static Platform::Thread* syncThread = nullptr;
 
-static unique_ptr<unordered_map<Platform::FileHandle*, int>> flushTimers;
+static bool MapFile(Platform::FileHandle* file) noexcept;
+static void UnmapFile(Platform::FileHandle* file) noexcept;
+static void QueueSync(Platform::FileHandle* file) noexcept;
+static bool SyncFile(Platform::FileHandle* file) noexcept;
+static void SyncThreadMain() noexcept;
 
 namespace Platform {
     constexpr unsigned GetRetroVfsFileAccessFlags(FileMode mode) noexcept {
@@ -113,6 +138,21 @@ Platform::FileHandle *Platform::OpenFile(const std::string& path, FileMode mode)
 
     retro::debug("Opened \"%s\" in FileMode 0x%x", path.c_str(), mode);
 
+    // Looked up once here, so that the sync thread never has to look inside the stream
+    handle->fd = retro::file_descriptor(handle->file);
+
+    if (handle->hints & RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS) {
+        frequentFiles.push_back(handle);
+
+        if ((mode & FileMode::ReadWrite) == FileMode::ReadWrite && (mode & FileMode::Preserve)) {
+            // If this is an existing disk image that's updated in place (e.g. an SD card image or the DSi NAND),
+            // serve its sector reads and writes from memory rather than with a syscall each.
+            // Read-only files aren't mapped, since the mapping would have to be read-only too
+            // and writing to it would crash instead of failing like a regular file.
+            MapFile(handle);
+        }
+    }
+
     return handle;
 }
 
@@ -168,7 +208,15 @@ bool Platform::CloseFile(FileHandle* file)
         return false;
     }
 
-    flushTimers->erase(file);
+    frequentFiles.erase(std::remove(frequentFiles.begin(), frequentFiles.end(), file), frequentFiles.end());
+
+    while (file->syncPending.load(std::memory_order_acquire)) {
+        // If the sync thread is still working on this file, wait for it to finish
+        // (closing the file would flush it anyway, but we can't free the handle out from under the thread)
+        std::this_thread::yield();
+    }
+
+    UnmapFile(file);
 
     char path[PATH_MAX];
     strlcpy(path, filestream_get_path(file->file), sizeof(path));
@@ -189,6 +237,9 @@ bool Platform::IsEndOfFile(FileHandle* file)
     if (!file)
         return false;
 
+    if (file->mapped)
+        return file->mappedPosition >= file->mappedLength;
+
     return filestream_eof(file->file) == EOF;
 }
 
@@ -197,6 +248,9 @@ bool Platform::FileReadLine(char* str, int count, FileHandle* file)
     if (!file || !str)
         return false;
 
+    // Text isn't worth serving from the mapping
+    UnmapFile(file);
+
     return filestream_gets(file->file, str, count);
 }
 
@@ -205,12 +259,34 @@ bool Platform::FileSeek(FileHandle* file, s64 offset, FileSeekOrigin origin)
     if (!file)
         return false;
 
+    if (file->mapped) {
+        s64 base = 0;
+        switch (origin) {
+            case FileSeekOrigin::Current:
+                base = file->mappedPosition;
+                break;
+            case FileSeekOrigin::End:
+                base = file->mappedLength;
+                break;
+            default:
+                break;
+        }
+
+        if (base + offset < 0)
+            return false;
+
+        file->mappedPosition = base + offset;
+        return true;
+    }
+
     return filestream_seek(file->file, offset, GetRetroVfsFileSeekOrigin(origin)) == 0;
 }
 
 void Platform::FileRewind(FileHandle* file)
 {
-    if (file)
+    if (file && file->mapped)
+        file->mappedPosition = 0;
+    else if (file)
         filestream_rewind(file->file);
 }
 
@@ -219,6 +295,14 @@ u64 Platform::FileRead(void* data, u64 size, u64 count, FileHandle* file)
     if (!file || !data)
         return 0;
 
+    if (file->mapped) {
+        u64 available = file->mappedPosition < file->mappedLength ? file->mappedLength - file->mappedPosition : 0;
+        u64 length = std::min(size * count, available);
+        memcpy(data, file->mapped + file->mappedPosition, length);
+        file->mappedPosition += length;
+        return length;
+    }
+
     return filestream_read(file->file, data, size * count);
 }
 
@@ -227,6 +311,11 @@ bool Platform::FileFlush(FileHandle* file)
     if (!file)
         return false;
 
+#ifdef HAVE_MMAP
+    if (file->mapped)
+        return msync(file->mapped, file->mappedLength, MS_ASYNC) == 0;
+#endif
+
     return filestream_flush(file->file) == 0;
 }
 
@@ -235,9 +324,36 @@ u64 Platform::FileWrite(const void* data, u64 size, u64 count, FileHandle* file)
     if (!file || !data)
         return 0;
 
-    u64 result = filestream_write(file->file, data, size * count);
+    u64 length = size * count;
+    if (melonds::IsSpeculating()) {
+        // If run-ahead is emulating frames that will be rolled back, don't let them change the file;
+        // the real frames will write the same data later.
+        // Just move past the data so that any following writes land where they would have.
+        if (file->mapped) {
+            file->mappedPosition += length;
+        } else {
+            filestream_seek(file->file, length, RETRO_VFS_SEEK_POSITION_CURRENT);
+        }
+        return length;
+    }
+
+    if (file->mapped && file->mappedPosition + length > file->mappedLength) {
+        // If this write would grow the file, the mapping can't hold it
+        UnmapFile(file);
+    }
+
+    u64 result;
+    if (file->mapped) {
+        memcpy(file->mapped + file->mappedPosition, data, length);
+        file->mappedPosition += length;
+        result = length;
+    } else {
+        result = filestream_write(file->file, data, length);
+    }
+
     if (file->hints & RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS) {
-        (*flushTimers)[file] = melonds::config::save::FlushDelay();
+        file->dirty = true;
+        file->timeUntilFlush = melonds::config::save::FlushDelay();
     }
 
     return result;
@@ -248,6 +364,8 @@ u64 Platform::FileWriteFormatted(FileHandle* file, const char* fmt, ...)
     if (!file || !fmt)
         return 0;
 
+    UnmapFile(file);
+
     va_list args;
     va_start(args, fmt);
     u64 ret = filestream_vprintf(file->file, fmt, args);
@@ -260,79 +378,232 @@ u64 Platform::FileLength(FileHandle* file)
     if (!file)
         return 0;
 
+    if (file->mapped)
+        return file->mappedLength;
+
     return filestream_get_size(file->file);
 }
 
 void melonds::file::init() {
-    retro_assert(flushTimers == nullptr);
-    flushTimers = std::make_unique<unordered_map<Platform::FileHandle*, int>>();
+    retro_assert(frequentFiles.empty());
+    retro_assert(syncThread == nullptr);
+    stopSyncThread = false;
+    syncSemaphore = Platform::Semaphore_Create();
+    if (syncSemaphore) {
+        syncThread = Platform::Thread_Create(SyncThreadMain);
+    }
+
+    if (!syncThread) {
+        // If this build doesn't support threads...
+        retro::debug("No sync thread available; files will be synced to disk on the main thread");
+    }
 }
 
 void melonds::file::deinit() {
-    retro_assert(flushTimers != nullptr);
-    for (auto& [file, timeUntilFlush] : *flushTimers) {
-        Platform::CloseFile(file);
+    if (syncThread) {
+        stopSyncThread = true;
+        Platform::Semaphore_Post(syncSemaphore, 1);
+        // Joining the thread also releases it
+        Platform::Thread_Wait(syncThread);
+        syncThread = nullptr;
+    }
+
+    if (syncSemaphore) {
+        Platform::Semaphore_Free(syncSemaphore);
+        syncSemaphore = nullptr;
+    }
+
+    for (Platform::FileHandle* file : vector(frequentFiles)) {
+        if (file->dirty) {
+            // CloseFile removes the file from frequentFiles, hence the copy
+            Platform::CloseFile(file);
+        }
+    }
+    frequentFiles.clear();
+}
+
+// Maps an open file's contents into memory for reading and writing,
+// using the descriptor behind the libretro VFS's stream.
+// Returns false (and leaves the file as-is) if the file can't be mapped,
+// in which case it'll keep using the stream.
+static bool MapFile(Platform::FileHandle* file) noexcept {
+#ifdef HAVE_MMAP
+    ZoneScopedN("melonds::file::MapFile");
+    const char* path = filestream_get_path(file->file);
+    int64_t length = filestream_get_size(file->file);
+    if (file->fd < 0 || length <= 0 || static_cast<uint64_t>(length) > SIZE_MAX) {
+        // If the frontend opened this file through its own VFS (so we have no descriptor for it),
+        // it's empty, or it's too big for our address space...
+        return false;
+    }
+
+    // Anything still buffered in the stream has to reach the file before we map it
+    filestream_flush(file->file);
+    struct stat info {};
+    if (fstat(file->fd, &info) != 0 || info.st_size != length) {
+        // If the descriptor doesn't refer to the file we think it does...
+        retro::warn("\"%s\" isn't %" PRId64 " bytes on disk, not mapping it into memory", path, length);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (mapped == MAP_FAILED) {
+        int error = errno;
+        retro::warn("Failed to map \"%s\" into memory, falling back to regular file I/O: %s", path, strerror(error));
+        return false;
+    }
+
+    file->mapped = static_cast<u8*>(mapped);
+    file->mappedLength = length;
+    file->mappedPosition = 0;
+    retro::debug("Mapped %zu-byte file \"%s\" into memory", file->mappedLength, path);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Switches a mapped file back to the stream, picking up where the mapping left off.
+// Anything written to the mapping is still written back to the file by the OS.
+static void UnmapFile(Platform::FileHandle* file) noexcept {
+#ifdef HAVE_MMAP
+    if (!file->mapped) {
+        return;
+    }
+
+    ZoneScopedN("melonds::file::UnmapFile");
+    munmap(file->mapped, file->mappedLength);
+    file->mapped = nullptr;
+    file->mappedLength = 0;
+    filestream_seek(file->file, file->mappedPosition, RETRO_VFS_SEEK_POSITION_START);
+#endif
+}
+
+// Hands off a dirty file to be synced to disk, on the sync thread if there is one.
+// Only call on the main thread.
+static void QueueSync(Platform::FileHandle* file) noexcept {
+    ZoneScopedN("melonds::file::QueueSync");
+    // Move any data buffered in userspace into the OS first,
+    // so that the sync thread never has to touch the RFILE itself
+    if (file->mapped) {
+#ifdef HAVE_MMAP
+        // Start writing back the mapping's dirty pages without waiting for them
+        msync(file->mapped, file->mappedLength, MS_ASYNC);
+#endif
+    } else {
+        filestream_flush(file->file);
+    }
+
+    if (!syncThread) {
+        SyncFile(file);
+        return;
+    }
+
+    file->syncPending.store(true, std::memory_order_relaxed);
+    Platform::FileHandle* head = pendingSyncs.load(std::memory_order_relaxed);
+    do {
+        file->nextPendingSync = head;
+    } while (!pendingSyncs.compare_exchange_weak(head, file, std::memory_order_release, std::memory_order_relaxed));
+
+    Platform::Semaphore_Post(syncSemaphore, 1);
+}
+
+// Forces a file's contents to the host disk.
+// Safe to call on the sync thread, as it only uses the file's descriptor.
+static bool SyncFile(Platform::FileHandle* file) noexcept {
+    ZoneScopedN("melonds::file::SyncFile");
+    retro_assert(file != nullptr);
+    retro_assert(file->file != nullptr);
+
+    const char* original_path = filestream_get_path(file->file);
+    retro_assert(original_path != nullptr);
+
+    if (file->fd < 0) {
+        // If the frontend opened this file through its own VFS, flushing the stream is all we can do
+        retro::debug("No descriptor for \"%s\"; can't force it to host disk", original_path);
+        return false;
+    }
+
+    if (retro::sync_file_descriptor(file->fd)) {
+        retro::debug("Flushed file \"%s\" to host disk", original_path);
+        return true;
+    } else {
+        int error = errno;
+        if (error == EBADF) {
+            retro::info("File \"%s\" was closed behind our backs, no need to flush it to disk.", original_path);
+        }
+        else {
+            retro::error("Failed to flush \"%s\" to host disk: %s (%x)", original_path, strerror(error), error);
+        }
+        return false;
+    }
+}
+
+bool melonds::file::Sync(const char* path) noexcept {
+    ZoneScopedN("melonds::file::Sync");
+    Platform::FileHandle file;
+    file.hints = RETRO_VFS_FILE_ACCESS_HINT_NONE;
+    // Some platforms (e.g. Windows) can only sync files that are open for writing
+    file.file = filestream_open(
+        path,
+        RETRO_VFS_FILE_ACCESS_READ_WRITE | RETRO_VFS_FILE_ACCESS_UPDATE_EXISTING,
+        RETRO_VFS_FILE_ACCESS_HINT_NONE
+    );
+    if (!file.file) {
+        retro::error("Failed to open \"%s\" to flush it to host disk", path);
+        return false;
+    }
+
+    file.fd = retro::file_descriptor(file.file);
+    bool synced = SyncFile(&file);
+    filestream_close(file.file);
+    return synced;
+}
+
+static void SyncThreadMain() noexcept {
+    while (true) {
+        Platform::Semaphore_Wait(syncSemaphore);
+
+        // Take every queued file at once, so the main thread can keep pushing without contention
+        Platform::FileHandle* file = pendingSyncs.exchange(nullptr, std::memory_order_acquire);
+        while (file) {
+            // Read the link before releasing the file, since the main thread may close it right after
+            Platform::FileHandle* next = file->nextPendingSync;
+            SyncFile(file);
+            file->syncPending.store(false, std::memory_order_release);
+            file = next;
+        }
+
+        if (stopSyncThread) {
+            break;
+        }
     }
-    flushTimers.reset();
 }
 
 retro::task::TaskSpec melonds::file::FlushTask() noexcept {
     retro::task::TaskSpec task([](retro::task::TaskHandle &task) {
         ZoneScopedN("melonds::fat::FlushTask");
-        using namespace melonds::file;
         if (task.IsCancelled()) {
             // If it's time to stop...
             task.Finish();
             return;
         }
 
-        std::vector<Platform::FileHandle*> filesToRemove;
-
-        for (auto& [file, timeUntilFlush] : *flushTimers) {
-            timeUntilFlush--;
-            if (timeUntilFlush == 0) {
-                // If the timer has reached 0, flush the file and remove it from the map
-
-                retro_assert(file != nullptr);
-                retro_assert(file->file != nullptr);
-
-                libretro_vfs_implementation_file* handle = filestream_get_vfs_handle(file->file);
-                const char* original_path = filestream_get_path(file->file);
-                retro_assert(handle != nullptr);
-                retro_assert(handle->fd >= 0);
-                retro_assert(original_path != nullptr);
-                // If the above conditions were false, the file should never have left Platform::OpenFile
-
-#ifdef _WIN32
-                int syncResult = _commit(handle->fd);
-#else
-                int syncResult = fsync(handle->fd);
-#endif
+        for (Platform::FileHandle* file : frequentFiles) {
+            if (!file->dirty || --file->timeUntilFlush > 0) {
+                // If this file doesn't need to be synced yet...
+                continue;
+            }
 
-                if (syncResult == 0) {
-                    retro::debug("Flushed file \"%s\" to host disk", original_path);
-                } else {
-                    int error = errno;
-                    if (error == EBADF) {
-                        retro::info("File \"%s\" was closed behind our backs, no need to flush it to disk.", original_path);
-                    }
-                    else {
-                        retro::error("Failed to flush \"%s\" to host disk: %s (%x)", original_path, strerror(error), error);
-                    }
-                }
-
-                // If the file is not open, then it was closed before the flush timer reached 0.
-                // In that case it will have been flushed to disk anyway, so we don't need to do anything.
-
-                filesToRemove.push_back(file);
+            if (file->syncPending.load(std::memory_order_acquire)) {
+                // If the last sync of this file is still in progress, try again next frame
+                continue;
             }
-        }
 
-        for (Platform::FileHandle* file : filesToRemove) {
-            int removed = flushTimers->erase(file);
-            retro_assert(removed == 1);
+            file->dirty = false;
+            QueueSync(file);
         }
     });
 
     return task;
-}
\ No newline at end of file
+}
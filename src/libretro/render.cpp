@@ -20,9 +20,14 @@
 #include "PlatformOGLPrivate.h"
 
 #include <optional>
+#include <string>
 
+#include <file/file_path.h>
 #include <retro_assert.h>
+#include <retro_miscellaneous.h>
+#include <streams/file_stream.h>
 #include <GPU3D.h>
+#include <NDS.h>
 
 #include "config.hpp"
 #include "input.hpp"
@@ -38,7 +43,21 @@ using glm::uvec2;
 
 namespace melonds::render {
     static Renderer _CurrentRenderer = Renderer::None;
+
+    constexpr const char* const CAPTURE_FILE_NAME = "melonDS DS video capture.bin";
+    constexpr uint32_t CAPTURE_VERSION = 1;
+    static bool _captureEnabled = false;
+    static RFILE* _captureFile = nullptr;
+
+    // True while the OpenGL renderer is reading frames back for the capture.
+    // Only changed outside of opengl::Render, since that's where the readback callback is called from.
+    static bool _readingBack = false;
+
     static void RenderSoftware(const InputState& input_state, ScreenLayoutData& screenLayout) noexcept;
+    static void OpenCapture() noexcept;
+    static void CloseCapture() noexcept;
+    static void UpdateReadback() noexcept;
+    static void Capture(uint32_t frame, const void* pixels, unsigned width, unsigned height, size_t pitch, CaptureFormat format) noexcept;
 }
 
 void melonds::render::Initialize(Renderer renderer) {
@@ -110,6 +129,17 @@ void melonds::render::RenderSoftware(const InputState& input_state, ScreenLayout
         screen_layout_data.Buffer().Height(),
         screen_layout_data.Buffer().Stride()
     );
+
+    if (_captureEnabled) {
+        Capture(
+            NDS::NumFrames,
+            screen_layout_data.Buffer()[0],
+            screen_layout_data.Buffer().Width(),
+            screen_layout_data.Buffer().Height(),
+            screen_layout_data.Buffer().Stride(),
+            CaptureFormat::Xrgb8888
+        );
+    }
 }
 
 melonds::Renderer melonds::render::CurrentRenderer() noexcept {
@@ -128,4 +158,103 @@ void melonds::render::Render(const InputState& input_state, ScreenLayoutData& sc
             render::RenderSoftware(input_state, screenLayout);
             break;
     }
+
+    // The capture may have failed during this frame
+    UpdateReadback();
+}
+
+void melonds::render::SetCaptureEnabled(bool enabled) noexcept {
+    _captureEnabled = enabled;
+    if (!enabled) {
+        CloseCapture();
+    }
+
+    UpdateReadback();
+}
+
+// Starts or stops reading back OpenGL frames to match whether we're capturing them
+static void melonds::render::UpdateReadback() noexcept {
+    if (_captureEnabled == _readingBack) {
+        return;
+    }
+
+    if (_captureEnabled) {
+        // The OpenGL renderer only calls this while it's rendering, so it's harmless to set under software rendering
+        opengl::SetReadbackCallback([](uint32_t frame, const void* pixels, unsigned width, unsigned height, size_t pitch) {
+            if (_captureEnabled) {
+                Capture(frame, pixels, width, height, pitch, CaptureFormat::Rgba8BottomUp);
+            }
+        });
+    } else {
+        opengl::SetReadbackCallback(nullptr);
+    }
+    _readingBack = _captureEnabled;
+}
+
+void melonds::render::ResetCapture() noexcept {
+    // Write out the OpenGL frames that are still in flight, so they don't end up at the start of the next capture
+    opengl::FlushReadbacks();
+    CloseCapture();
+}
+
+static void melonds::render::OpenCapture() noexcept {
+    ZoneScopedN("melonds::render::OpenCapture");
+    const std::optional<std::string>& save_directory = retro::get_save_directory();
+    if (!save_directory) {
+        retro::error("Failed to get save directory; can't capture video");
+        _captureEnabled = false;
+        return;
+    }
+
+    char path[PATH_MAX];
+    fill_pathname_join_special(path, save_directory->c_str(), CAPTURE_FILE_NAME, sizeof(path));
+    _captureFile = filestream_open(path, RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+    if (!_captureFile) {
+        retro::error("Failed to open video capture file \"%s\"", path);
+        _captureEnabled = false;
+        return;
+    }
+
+    CaptureHeader header { {'M', 'D', 'S', 'V'}, CAPTURE_VERSION };
+    if (filestream_write(_captureFile, &header, sizeof(header)) != sizeof(header)) {
+        retro::error("Failed to write to video capture file \"%s\"; capture disabled", path);
+        CloseCapture();
+        _captureEnabled = false;
+        return;
+    }
+
+    retro::info("Capturing composed frames to \"%s\"", path);
+}
+
+static void melonds::render::CloseCapture() noexcept {
+    if (_captureFile) {
+        filestream_close(_captureFile);
+        _captureFile = nullptr;
+    }
+}
+
+static void melonds::render::Capture(uint32_t frame, const void* pixels, unsigned width, unsigned height, size_t pitch, CaptureFormat format) noexcept {
+    ZoneScopedN("melonds::render::Capture");
+    if (!_captureFile) {
+        OpenCapture();
+        if (!_captureFile) {
+            return;
+        }
+    }
+
+    CaptureRecord record { frame, width, height, format };
+    bool ok = filestream_write(_captureFile, &record, sizeof(record)) == sizeof(record);
+    int64_t rowSize = static_cast<int64_t>(width) * 4;
+    const auto* rows = static_cast<const uint8_t*>(pixels);
+    for (unsigned y = 0; ok && y < height; ++y) {
+        ok = filestream_write(_captureFile, rows + y * pitch, rowSize) == rowSize;
+    }
+
+    if (!ok) {
+        // If the disk is full (or the file went away)...
+        // Stop here, so that the only damage is a truncated record at the end of the capture
+        retro::error("Failed to write to video capture file; capture disabled");
+        CloseCapture();
+        _captureEnabled = false;
+    }
 }
\ No newline at end of file
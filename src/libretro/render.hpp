@@ -17,6 +17,8 @@
 #ifndef MELONDS_DS_RENDER_HPP
 #define MELONDS_DS_RENDER_HPP
 
+#include <cstdint>
+
 #include "config.hpp"
 
 namespace melonds {
@@ -34,6 +36,38 @@ namespace melonds::render {
     Renderer CurrentRenderer() noexcept;
 
     void Render(const InputState& input_state, ScreenLayoutData& screenLayout) noexcept;
+
+    /// Starts or stops recording each composed frame to a capture file in the save directory.
+    /// The file starts with a CaptureHeader, followed by one CaptureRecord (and its rows) for each frame,
+    /// all in native byte order.
+    /// OpenGL frames arrive through opengl::SetReadbackCallback, so they're written a frame or two late.
+    void SetCaptureEnabled(bool enabled) noexcept;
+
+    /// Closes the capture file (if any), so that the next frame starts a new capture.
+    void ResetCapture() noexcept;
+
+    struct CaptureHeader {
+        char Magic[4]; // "MDSV"
+        uint32_t Version;
+    };
+
+    enum class CaptureFormat : uint32_t {
+        /// 32-bit XRGB8888 pixels, top row first, as given to the frontend by the software renderer.
+        Xrgb8888 = 0,
+
+        /// RGBA8 bytes, bottom row first, as read back from OpenGL.
+        Rgba8BottomUp = 1,
+    };
+
+    struct CaptureRecord {
+        /// The value of NDS::NumFrames when this frame was drawn.
+        uint32_t Frame;
+        uint32_t Width;
+        uint32_t Height;
+        CaptureFormat Format;
+
+        // Followed by Height rows of Width * 4 bytes each, without padding
+    };
 }
 
 #endif //MELONDS_DS_RENDER_HPP
@@ -29,6 +29,9 @@ using std::nullopt;
 namespace retro::microphone {
     static optional<struct retro_microphone_interface> _microphone_interface;
     static retro_microphone_t* _microphone_handle;
+
+    // The state we last asked the frontend for; reset whenever the handle changes
+    static optional<bool> _requested_state;
 }
 
 void retro::microphone::init_interface() noexcept {
@@ -65,6 +68,7 @@ void retro::microphone::clear_interface() noexcept {
     }
     _microphone_interface = nullopt;
     _microphone_handle = nullptr;
+    _requested_state = nullopt;
 }
 
 bool retro::microphone::set_open(bool open) noexcept {
@@ -85,6 +89,7 @@ bool retro::microphone::set_open(bool open) noexcept {
             .rate = 44100, // melonDS expects this rate
         };
         _microphone_handle = _microphone_interface->open_mic(&params);
+        _requested_state = nullopt;
         return _microphone_handle != nullptr;
     }
     else {
@@ -96,6 +101,7 @@ bool retro::microphone::set_open(bool open) noexcept {
 
         _microphone_interface->close_mic(_microphone_handle);
         _microphone_handle = nullptr;
+        _requested_state = nullopt;
 
         return true;
     }
@@ -111,12 +117,24 @@ bool retro::microphone::set_state(bool on) noexcept {
         return false; // Can't set the state
     }
 
+    if (_requested_state == on) {
+        // If we've already asked for this state...
+        return true; // No need to bother the frontend every frame
+    }
+
+    ZoneScopedN("retro::microphone::set_state");
     if (_microphone_interface->get_mic_state(_microphone_handle) == on) {
         // If the microphone is already in the desired state...
+        _requested_state = on;
         return true; // Good; we want it in that state anyway
     }
 
-    return _microphone_interface->set_mic_state(_microphone_handle, on);
+    bool ok = _microphone_interface->set_mic_state(_microphone_handle, on);
+    if (ok) {
+        _requested_state = on;
+    }
+
+    return ok;
 }
 optional<bool> retro::microphone::get_state() noexcept
 {
@@ -128,6 +146,20 @@ optional<bool> retro::microphone::get_state() noexcept
     return _microphone_interface->get_mic_state(_microphone_handle);
 }
 
+optional<unsigned> retro::microphone::get_rate() noexcept {
+    if (!_microphone_interface || !_microphone_handle) {
+        // If we don't have microphone support available...
+        return nullopt;
+    }
+
+    retro_microphone_params_t params {};
+    if (!_microphone_interface->get_params(_microphone_handle, &params) || params.rate == 0) {
+        return nullopt;
+    }
+
+    return params.rate;
+}
+
 optional<int> retro::microphone::read(int16_t* samples, size_t num_samples) noexcept
 {
     ZoneScopedN("retro::microphone::read");
@@ -29,6 +29,10 @@ namespace retro::microphone {
     bool is_open() noexcept;
     bool set_state(bool on) noexcept;
     std::optional<bool> get_state() noexcept;
+
+    /// The rate (in Hz) that the open microphone actually delivers samples at,
+    /// which may differ from the rate we asked for.
+    std::optional<unsigned> get_rate() noexcept;
     std::optional<int> read(int16_t* samples, size_t num_samples) noexcept;
 }
 
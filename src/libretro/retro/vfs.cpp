@@ -0,0 +1,70 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include "vfs.hpp"
+
+#include <cerrno>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <vfs/vfs.h>
+
+#include "environment.hpp"
+
+int retro::file_descriptor(RFILE* file) noexcept {
+    if (!file || uses_frontend_vfs()) {
+        // If the file's VFS handle belongs to the frontend, we can't look inside it
+        return -1;
+    }
+
+    libretro_vfs_implementation_file* handle = filestream_get_vfs_handle(file);
+    if (!handle) {
+        return -1;
+    }
+
+    if (handle->fp) {
+        // If this is a buffered stream, its fd field is never set
+        // (it's left at 0, which would be stdin)
+#ifdef _WIN32
+        return _fileno(handle->fp);
+#else
+        return fileno(handle->fp);
+#endif
+    }
+
+    return handle->fd > 0 ? handle->fd : -1;
+}
+
+bool retro::sync_file_descriptor(int fd) noexcept {
+    if (fd < 0) {
+        errno = EBADF;
+        return false;
+    }
+
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#elif defined(__linux__) || defined(__ANDROID__)
+    // The file's size and contents are what matter, not its timestamps
+    return fdatasync(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
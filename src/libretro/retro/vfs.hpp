@@ -0,0 +1,34 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef MELONDS_DS_VFS_HPP
+#define MELONDS_DS_VFS_HPP
+
+#include <streams/file_stream.h>
+
+namespace retro {
+    /// The host OS's descriptor for a file opened by libretro-common's own VFS implementation,
+    /// or -1 if it was opened by the frontend's VFS or has no descriptor.
+    /// Buffered streams (the default) keep their descriptor in their FILE*, not in the VFS handle's fd,
+    /// so flush the stream before using the descriptor to read, map, or sync the file.
+    int file_descriptor(RFILE* file) noexcept;
+
+    /// Forces everything written to the given descriptor to the host disk.
+    /// \returns false (with errno set) if the data couldn't be synced.
+    bool sync_file_descriptor(int fd) noexcept;
+}
+
+#endif //MELONDS_DS_VFS_HPP
@@ -0,0 +1,267 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include "rewind.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include <libretro.h>
+
+#include "environment.hpp"
+#include "sram.hpp"
+#include "statebuffer.hpp"
+#include "tracy.hpp"
+
+using std::deque;
+using std::vector;
+
+// Each delta holds what's needed to turn the newer of two consecutive states back into the older one.
+// Only the pages that differ are stored; each of those is stored as the XOR of the two pages,
+// run-length encoded so that the (usually many) unchanged bytes within a changed page cost almost nothing.
+//
+// Delta layout (native byte order, since deltas never leave the process):
+//   repeated for each changed page:
+//     uint32_t page index
+//     repeated until the page is covered:
+//       uint16_t number of unchanged bytes to skip
+//       uint16_t number of changed bytes that follow
+//       uint8_t  XORed bytes[...]
+namespace melonds::rewind {
+    // Most of the state is the DS's memory, so this is a natural unit of change
+    constexpr size_t PAGE_SIZE = 4096;
+
+    // A run of unchanged bytes shorter than this is cheaper to store as part of a literal
+    constexpr size_t MIN_SKIP = 8;
+
+    static size_t _capacity = 0;
+
+    // The most recently captured state, and space to serialize the next one
+    static StateBuffer _current;
+    static StateBuffer _next;
+
+    // Oldest first
+    static deque<vector<uint8_t>> _deltas;
+    static size_t _bytes = 0;
+
+    static void EncodeDelta(const uint8_t* newer, const uint8_t* older, size_t size, vector<uint8_t>& delta) noexcept;
+    static void ApplyDelta(const vector<uint8_t>& delta, uint8_t* state, size_t size) noexcept;
+    static void Trim() noexcept;
+}
+
+void melonds::rewind::SetBufferSize(size_t bytes) noexcept {
+    ZoneScopedN("melonds::rewind::SetBufferSize");
+    if (bytes == _capacity) {
+        return;
+    }
+
+    _capacity = bytes;
+    if (bytes == 0) {
+        // If we're turning off rewind, give back all the memory it was using
+        Reset();
+        retro::debug("Disabled in-core rewind");
+    } else {
+        Trim();
+        retro::debug("Set rewind buffer size to %zuMiB", bytes / 1024 / 1024);
+    }
+}
+
+bool melonds::rewind::Enabled() noexcept {
+    return _capacity > 0;
+}
+
+void melonds::rewind::Reset() noexcept {
+    ZoneScopedN("melonds::rewind::Reset");
+    _deltas.clear();
+    _bytes = 0;
+    _current.Clear();
+    _next.Clear();
+}
+
+void melonds::rewind::Capture() noexcept {
+    ZoneScopedN("melonds::rewind::Capture");
+    if (_capacity == 0) {
+        return;
+    }
+
+    if (retro_serialize_size() == 0) {
+        // If savestates aren't supported right now (e.g. in DSi mode)...
+        return;
+    }
+
+    if (!_next.Save()) {
+        retro::warn("Failed to capture a state for rewinding");
+        return;
+    }
+
+    if (_current.Size() == _next.Size()) {
+        vector<uint8_t> delta;
+        EncodeDelta(_next.Data(), _current.Data(), _next.Size(), delta);
+        _bytes += delta.capacity();
+        _deltas.emplace_back(std::move(delta));
+        Trim();
+    } else if (!_current.Empty()) {
+        // If the savestate size changed, the old history can't be applied to new states
+        _deltas.clear();
+        _bytes = 0;
+    }
+
+    std::swap(_current, _next);
+
+    TracyPlot("Rewind Buffer Bytes", static_cast<int64_t>(_bytes));
+    TracyPlot("Rewind Buffer Frames", static_cast<int64_t>(_deltas.size()));
+}
+
+bool melonds::rewind::Step() noexcept {
+    ZoneScopedN("melonds::rewind::Step");
+    if (_current.Empty()) {
+        return false;
+    }
+
+    bool stepped = false;
+    if (!_deltas.empty()) {
+        ApplyDelta(_deltas.back(), _current.Data(), _current.Size());
+        _bytes -= _deltas.back().capacity();
+        _deltas.pop_back();
+        stepped = true;
+    }
+
+    if (!_current.Load()) {
+        retro::error("Failed to restore a rewound state; discarding rewind history");
+        Reset();
+        return false;
+    }
+
+    // Rewinding takes the save data back in time too
+    sram::SyncNdsSave();
+    return stepped;
+}
+
+melonds::rewind::RewindMetrics melonds::rewind::Metrics() noexcept {
+    return {
+        .Frames = _deltas.size(),
+        .Bytes = _bytes,
+        .Capacity = _capacity,
+    };
+}
+
+static void melonds::rewind::EncodeDelta(const uint8_t* newer, const uint8_t* older, size_t size, vector<uint8_t>& delta) noexcept {
+    ZoneScopedN("melonds::rewind::EncodeDelta");
+    auto append = [&delta](const void* data, size_t length) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        delta.insert(delta.end(), bytes, bytes + length);
+    };
+
+    for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+        size_t length = std::min(PAGE_SIZE, size - offset);
+        const uint8_t* a = newer + offset;
+        const uint8_t* b = older + offset;
+        if (memcmp(a, b, length) == 0) {
+            // If this page didn't change at all (by far the most common case)...
+            continue;
+        }
+
+        uint32_t page = offset / PAGE_SIZE;
+        append(&page, sizeof(page));
+
+        size_t i = 0;
+        while (i < length) {
+            size_t skipStart = i;
+            while (i < length && a[i] == b[i]) {
+                ++i;
+            }
+            uint16_t skip = i - skipStart;
+
+            // Extend the literal over short runs of unchanged bytes,
+            // stopping at a long one (or the end of the page)
+            size_t literalStart = i;
+            while (i < length) {
+                if (a[i] != b[i]) {
+                    ++i;
+                    continue;
+                }
+
+                size_t run = 0;
+                while (i + run < length && run < MIN_SKIP && a[i + run] == b[i + run]) {
+                    ++run;
+                }
+
+                if (run >= MIN_SKIP || i + run == length) {
+                    break;
+                }
+                i += run;
+            }
+            uint16_t literal = i - literalStart;
+
+            append(&skip, sizeof(skip));
+            append(&literal, sizeof(literal));
+            for (size_t j = literalStart; j < i; ++j) {
+                delta.push_back(a[j] ^ b[j]);
+            }
+
+            if (literal == 0) {
+                // If the rest of the page was unchanged...
+                i = length;
+            }
+        }
+    }
+
+    delta.shrink_to_fit();
+}
+
+static void melonds::rewind::ApplyDelta(const vector<uint8_t>& delta, uint8_t* state, size_t size) noexcept {
+    ZoneScopedN("melonds::rewind::ApplyDelta");
+    const uint8_t* in = delta.data();
+    const uint8_t* end = in + delta.size();
+
+    while (in < end) {
+        uint32_t page;
+        memcpy(&page, in, sizeof(page));
+        in += sizeof(page);
+
+        size_t offset = static_cast<size_t>(page) * PAGE_SIZE;
+        size_t length = std::min(PAGE_SIZE, size - offset);
+        size_t i = 0;
+        while (i < length) {
+            uint16_t skip, literal;
+            memcpy(&skip, in, sizeof(skip));
+            memcpy(&literal, in + sizeof(skip), sizeof(literal));
+            in += sizeof(skip) + sizeof(literal);
+
+            i += skip;
+            for (size_t j = 0; j < literal; ++j) {
+                state[offset + i + j] ^= in[j];
+            }
+            in += literal;
+            i += literal;
+
+            if (literal == 0) {
+                i = length;
+            }
+        }
+    }
+}
+
+// Drops the oldest deltas until the history fits in its buffer again
+static void melonds::rewind::Trim() noexcept {
+    while (_bytes > _capacity && !_deltas.empty()) {
+        _bytes -= _deltas.front().capacity();
+        _deltas.pop_front();
+    }
+}
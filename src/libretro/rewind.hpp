@@ -0,0 +1,55 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef MELONDS_DS_REWIND_HPP
+#define MELONDS_DS_REWIND_HPP
+
+#include <cstddef>
+
+//! In-core rewind, storing each frame as a delta against the next one.
+
+namespace melonds::rewind {
+    struct RewindMetrics {
+        /// How many frames we can currently rewind through.
+        size_t Frames;
+
+        /// The memory used by the stored deltas, not counting the two full states we keep.
+        size_t Bytes;
+
+        size_t Capacity;
+    };
+
+    /// Sets how much memory the rewind history may use, or 0 to disable rewind.
+    /// Discards the oldest history if it no longer fits.
+    void SetBufferSize(size_t bytes) noexcept;
+
+    [[nodiscard]] bool Enabled() noexcept;
+
+    /// Discards all rewind history, e.g. when a new game is loaded.
+    void Reset() noexcept;
+
+    /// Records the current emulator state. Call once per frame before running it.
+    void Capture() noexcept;
+
+    /// Restores the state recorded just before the most recent one.
+    /// If there's no more history, restores the oldest state instead so that the game stays put.
+    /// \returns true if the game went back a frame.
+    bool Step() noexcept;
+
+    [[nodiscard]] RewindMetrics Metrics() noexcept;
+}
+
+#endif //MELONDS_DS_REWIND_HPP
@@ -0,0 +1,592 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include "savestate.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <compat/strl.h>
+#include <file/file_path.h>
+#include <libretro.h>
+#include <retro_miscellaneous.h>
+#include <streams/file_stream.h>
+#include <streams/trans_stream.h>
+#include <Platform.h>
+
+#include "config.hpp"
+#include "environment.hpp"
+#include "retro/task_queue.hpp"
+#include "statebuffer.hpp"
+#include "tracy.hpp"
+#include "utils.hpp"
+
+using std::optional;
+using std::string;
+using std::vector;
+
+// Compressed container layout (native byte order):
+//   CompressedHeader
+//   uint32_t compressed size of each chunk[ceil(UncompressedSize / ChunkSize)]
+//   the chunks' deflate streams, back to back
+namespace melonds::savestate {
+    constexpr char COMPRESSED_MAGIC[4] = {'M', 'D', 'S', 'Z'};
+    constexpr uint32_t COMPRESSED_VERSION = 2;
+
+    // Savestates are mostly RAM, which is mostly zeroes;
+    // the fastest level still collapses those to almost nothing.
+    constexpr uint32_t COMPRESSION_LEVEL = 1;
+
+    // Each chunk is compressed independently so that they can all be (de)compressed in parallel.
+    // Small enough to keep several cores busy with a ~5MiB state,
+    // big enough that the per-chunk overhead doesn't matter.
+    constexpr uint32_t CHUNK_SIZE = 512 * 1024;
+
+    constexpr const char* const AUTO_SAVE_STATE_EXTENSION = ".auto.state";
+
+    // Owned by the writer thread while one is running, so it can't live in the state arena
+    static StateBuffer _autoSaveState(StateStorage::Owned);
+    static Platform::Thread* _autoSaveWriter = nullptr;
+    static std::atomic_bool _autoSaveWriterDone = false;
+
+    // Helper threads for ParallelFor, started the first time it's used and kept until deinit;
+    // the thread that calls ParallelFor does its share of the work too.
+    // Only one call can use the pool at a time (e.g. the main thread and the auto-save writer can overlap),
+    // so any other call runs on its caller's thread instead of waiting.
+    static vector<Platform::Thread*> _workers;
+    static Platform::Semaphore* _workAvailable = nullptr;
+    static Platform::Semaphore* _workDone = nullptr;
+    static bool _workersStarted = false;
+    static std::atomic_bool _stopWorkers = false;
+    static std::atomic_flag _poolBusy = ATOMIC_FLAG_INIT;
+
+    // The job that the pool is currently working on; only changed while no worker is running it
+    static const std::function<void(size_t)>* _job = nullptr;
+    static size_t _jobCount = 0;
+    static std::atomic_size_t _jobNext = 0;
+
+    static optional<string> AutoSaveStatePath(const retro_game_info& nds_info) noexcept;
+    static void StartAutoSaveState(const string& path) noexcept;
+    static void FinishAutoSaveState() noexcept;
+    static bool WriteAutoSaveState(const string& path, const StateBuffer& state) noexcept;
+    static size_t ChunkCount(size_t size, size_t chunkSize) noexcept;
+    static size_t ChunkBound(size_t size) noexcept;
+    static void ParallelFor(size_t count, const std::function<void(size_t)>& fn) noexcept;
+    static void StartWorkers() noexcept;
+    static void WorkerMain() noexcept;
+    static void RunJob() noexcept;
+}
+
+void melonds::savestate::deinit() noexcept {
+    ZoneScopedN("melonds::savestate::deinit");
+    if (!_workers.empty()) {
+        _stopWorkers = true;
+        Platform::Semaphore_Post(_workAvailable, static_cast<int>(_workers.size()));
+        for (Platform::Thread* worker : _workers) {
+            // Joining the thread also releases it
+            Platform::Thread_Wait(worker);
+        }
+        _workers.clear();
+    }
+
+    if (_workAvailable) {
+        Platform::Semaphore_Free(_workAvailable);
+        _workAvailable = nullptr;
+    }
+
+    if (_workDone) {
+        Platform::Semaphore_Free(_workDone);
+        _workDone = nullptr;
+    }
+
+    _stopWorkers = false;
+    _workersStarted = false;
+}
+
+bool melonds::savestate::IsFastSavestate() noexcept {
+#ifdef RETRO_ENVIRONMENT_GET_SAVESTATE_CONTEXT
+    int context = RETRO_SAVESTATE_CONTEXT_NORMAL;
+    if (retro::environment(RETRO_ENVIRONMENT_GET_SAVESTATE_CONTEXT, &context)) {
+        return context != RETRO_SAVESTATE_CONTEXT_NORMAL;
+    }
+#endif
+
+    // Older frontends signal the same thing with bit 2 of the A/V enable flags
+    int flags = 0;
+    if (retro::environment(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &flags)) {
+        return flags & 4;
+    }
+
+    return false;
+}
+
+size_t melonds::savestate::MaxCompressedSize(size_t size) noexcept {
+    size_t chunks = ChunkCount(size, CHUNK_SIZE);
+    size_t bound = sizeof(CompressedHeader) + chunks * sizeof(uint32_t);
+    if (chunks > 0) {
+        bound += (chunks - 1) * ChunkBound(CHUNK_SIZE) + ChunkBound(size - (chunks - 1) * CHUNK_SIZE);
+    }
+
+    return bound;
+}
+
+size_t melonds::savestate::Compress(const uint8_t* state, size_t size, uint8_t* output, size_t capacity) noexcept {
+    ZoneScopedN("melonds::savestate::Compress");
+#ifdef HAVE_ZLIB
+    size_t chunks = ChunkCount(size, CHUNK_SIZE);
+    size_t dataOffset = sizeof(CompressedHeader) + chunks * sizeof(uint32_t);
+    if (capacity < dataOffset) {
+        return 0;
+    }
+
+    // Chunks are compressed here before they're packed together,
+    // since we don't know where each one goes until they're all done.
+    // Not kept between calls, since an auto-save state may be compressed on another thread.
+    size_t scratchStride = ChunkBound(CHUNK_SIZE);
+    vector<uint8_t> scratch(chunks * scratchStride);
+    vector<uint32_t> lengths(chunks, 0);
+    std::atomic_bool failed = false;
+
+    ParallelFor(chunks, [&](size_t i) {
+        ZoneScopedN("melonds::savestate::Compress::Chunk");
+        size_t offset = i * CHUNK_SIZE;
+        size_t length = std::min<size_t>(CHUNK_SIZE, size - offset);
+
+        void* stream = zlib_deflate_backend.stream_new();
+        if (!stream) {
+            failed = true;
+            return;
+        }
+
+        zlib_deflate_backend.define(stream, "level", COMPRESSION_LEVEL);
+        zlib_deflate_backend.set_in(stream, state + offset, length);
+        zlib_deflate_backend.set_out(stream, &scratch[i * scratchStride], scratchStride);
+
+        uint32_t read = 0;
+        uint32_t written = 0;
+        trans_stream_error error = TRANS_STREAM_ERROR_NONE;
+        bool ok = zlib_deflate_backend.trans(stream, true, &read, &written, &error);
+        zlib_deflate_backend.stream_free(stream);
+
+        if (!ok || error != TRANS_STREAM_ERROR_NONE || read != length) {
+            failed = true;
+            return;
+        }
+
+        lengths[i] = written;
+    });
+
+    if (failed) {
+        retro::error("Failed to compress savestate");
+        return 0;
+    }
+
+    size_t total = dataOffset;
+    for (uint32_t length : lengths) {
+        total += length;
+    }
+
+    if (total > capacity) {
+        // If the compressed state didn't fit...
+        retro::error("Compressed savestate needs %zuB, but only %zuB are available", total, capacity);
+        return 0;
+    }
+
+    CompressedHeader header {};
+    memcpy(header.Magic, COMPRESSED_MAGIC, sizeof(header.Magic));
+    header.Version = COMPRESSED_VERSION;
+    header.UncompressedSize = size;
+    header.CompressedSize = total - sizeof(header);
+    header.ChunkSize = CHUNK_SIZE;
+    memcpy(output, &header, sizeof(header));
+    memcpy(output + sizeof(header), lengths.data(), chunks * sizeof(uint32_t));
+
+    uint8_t* out = output + dataOffset;
+    for (size_t i = 0; i < chunks; ++i) {
+        memcpy(out, &scratch[i * scratchStride], lengths[i]);
+        out += lengths[i];
+    }
+
+    return total;
+#else
+    return 0;
+#endif
+}
+
+bool melonds::savestate::IsCompressed(const void* data, size_t size) noexcept {
+    return size >= sizeof(CompressedHeader) && memcmp(data, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC)) == 0;
+}
+
+bool melonds::savestate::Decompress(const void* data, size_t size, size_t maxSize, vector<uint8_t>& state) noexcept {
+    ZoneScopedN("melonds::savestate::Decompress");
+    CompressedHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.Version != COMPRESSED_VERSION) {
+        retro::error("Unsupported compressed savestate version %u", header.Version);
+        return false;
+    }
+
+    if (sizeof(header) + header.CompressedSize > size) {
+        retro::error("Compressed savestate is truncated (expected %u bytes, got %zu)", header.CompressedSize, size - sizeof(header));
+        return false;
+    }
+
+    if (header.UncompressedSize > maxSize) {
+        // If the header claims a bigger state than this game could ever produce (i.e. it's corrupt or hostile)...
+        retro::error("Compressed savestate claims to hold %uB, but this game's states are at most %zuB", header.UncompressedSize, maxSize);
+        return false;
+    }
+
+    if (header.ChunkSize == 0) {
+        retro::error("Compressed savestate has an invalid chunk size");
+        return false;
+    }
+
+    // Checked in 64 bits, so that a tiny chunk size can't overflow the index's size on 32-bit platforms
+    uint64_t chunkCount = (static_cast<uint64_t>(header.UncompressedSize) + header.ChunkSize - 1) / header.ChunkSize;
+    if (chunkCount * sizeof(uint32_t) > header.CompressedSize) {
+        retro::error("Compressed savestate's chunk index is truncated");
+        return false;
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    size_t chunks = static_cast<size_t>(chunkCount);
+    size_t dataOffset = sizeof(header) + chunks * sizeof(uint32_t);
+
+    // Work out where each chunk starts, so that they can be decompressed in any order
+    vector<uint32_t> lengths(chunks);
+    vector<size_t> offsets(chunks);
+    memcpy(lengths.data(), bytes + sizeof(header), chunks * sizeof(uint32_t));
+    uint64_t end = dataOffset;
+    for (size_t i = 0; i < chunks; ++i) {
+        offsets[i] = static_cast<size_t>(end);
+        end += lengths[i];
+    }
+
+    if (end != sizeof(header) + header.CompressedSize) {
+        retro::error("Compressed savestate's chunk index doesn't match its size");
+        return false;
+    }
+
+#ifdef HAVE_ZLIB
+    state.resize(header.UncompressedSize);
+    std::atomic_bool failed = false;
+
+    ParallelFor(chunks, [&](size_t i) {
+        ZoneScopedN("melonds::savestate::Decompress::Chunk");
+        size_t offset = i * header.ChunkSize;
+        size_t length = std::min<size_t>(header.ChunkSize, header.UncompressedSize - offset);
+
+        void* stream = zlib_inflate_backend.stream_new();
+        if (!stream) {
+            failed = true;
+            return;
+        }
+
+        zlib_inflate_backend.set_in(stream, bytes + offsets[i], lengths[i]);
+        zlib_inflate_backend.set_out(stream, state.data() + offset, length);
+
+        uint32_t read = 0;
+        uint32_t written = 0;
+        trans_stream_error error = TRANS_STREAM_ERROR_NONE;
+        bool ok = zlib_inflate_backend.trans(stream, true, &read, &written, &error);
+        zlib_inflate_backend.stream_free(stream);
+
+        if (!ok || error != TRANS_STREAM_ERROR_NONE || written != length) {
+            failed = true;
+        }
+    });
+
+    if (failed) {
+        retro::error("Failed to decompress savestate");
+        return false;
+    }
+
+    return true;
+#else
+    retro::error("This build of melonDS DS can't load compressed savestates");
+    return false;
+#endif
+}
+
+// Returns the path to the given game's auto-save state, or nullopt if there's no save directory
+static optional<string> melonds::savestate::AutoSaveStatePath(const retro_game_info& nds_info) noexcept {
+    const optional<string>& save_directory = retro::get_save_directory();
+    if (!save_directory) {
+        return std::nullopt;
+    }
+
+    char game_name[PATH_MAX];
+    GetGameName(nds_info, game_name, sizeof(game_name));
+    strlcat(game_name, AUTO_SAVE_STATE_EXTENSION, sizeof(game_name));
+
+    char path[PATH_MAX];
+    fill_pathname_join_special(path, save_directory->c_str(), game_name, sizeof(path));
+    return string(path);
+}
+
+bool melonds::savestate::LoadAutoSaveState(const retro_game_info& nds_info) noexcept {
+    ZoneScopedN("melonds::savestate::LoadAutoSaveState");
+    if (config::savestate::AutoSaveStateInterval() == 0) {
+        // If auto-save states are disabled...
+        return false;
+    }
+
+    optional<string> path = AutoSaveStatePath(nds_info);
+    if (!path || !path_is_valid(path->c_str())) {
+        // If there's no auto-save state to load (e.g. this is the first time the game's been played)...
+        return false;
+    }
+
+    void* data = nullptr;
+    int64_t length = 0;
+    if (!filestream_read_file(path->c_str(), &data, &length) || data == nullptr) {
+        retro::error("Failed to read auto-save state from \"%s\"", path->c_str());
+        return false;
+    }
+
+    // The state may or may not be compressed, and retro_unserialize handles both.
+    // It also updates the save data that the frontend sees.
+    bool loaded = retro_unserialize(data, static_cast<size_t>(length));
+    free(data);
+
+    if (loaded) {
+        retro::info("Resumed from auto-save state \"%s\"", path->c_str());
+    } else {
+        retro::error("Failed to load auto-save state from \"%s\"", path->c_str());
+    }
+
+    return loaded;
+}
+
+retro::task::TaskSpec melonds::savestate::AutoSaveStateTask(const retro_game_info& nds_info) noexcept {
+    optional<string> path = AutoSaveStatePath(nds_info);
+    if (!path) {
+        retro::warn("No save directory available, auto-save states will be disabled");
+        return retro::task::TaskSpec([](retro::task::TaskHandle& task) noexcept { task.Finish(); });
+    }
+
+    return retro::task::TaskSpec(
+        [path=*path, timeToAutoSave=optional<unsigned>()](retro::task::TaskHandle&) mutable noexcept {
+            ZoneScopedN("melonds::savestate::AutoSaveStateTask");
+            if (_autoSaveWriter && _autoSaveWriterDone) {
+                // If the last auto-save state has been written...
+                FinishAutoSaveState();
+            }
+
+            unsigned interval = config::savestate::AutoSaveStateInterval();
+            if (interval == 0) {
+                // If auto-save states are disabled...
+                timeToAutoSave = std::nullopt;
+                return;
+            }
+
+            if (!timeToAutoSave) {
+                // If auto-save states were just enabled, or we just wrote one...
+                timeToAutoSave = interval * 60 * 60; // Minutes to frames
+            }
+
+            if (*timeToAutoSave > 0) {
+                --*timeToAutoSave;
+                return;
+            }
+
+            if (_autoSaveWriter) {
+                // If the last auto-save state is somehow still being written, try again next frame
+                return;
+            }
+
+            StartAutoSaveState(path);
+            timeToAutoSave = std::nullopt;
+        },
+        nullptr,
+        [path=*path](retro::task::TaskHandle&) noexcept {
+            ZoneScopedN("melonds::savestate::AutoSaveStateTask::Cleanup");
+            FinishAutoSaveState();
+
+            if (config::savestate::AutoSaveStateInterval() > 0 && retro_serialize_size() > 0 && _autoSaveState.Save()) {
+                // If the game is being closed, save its final state;
+                // no need for a separate thread, since there won't be another frame to hold up
+                WriteAutoSaveState(path, _autoSaveState);
+            }
+
+            _autoSaveState.Clear();
+        }
+    );
+}
+
+// Takes a snapshot of the emulator state on this thread, then compresses it and writes it to disk on another.
+// melonDS keeps its state in globals spread across every subsystem,
+// so the snapshot can't be a single memcpy of one block;
+// it's one NDS::DoSavestate pass into a buffer that's reused from one auto-save state to the next.
+// That pass is only a series of copies, with no allocation, compression or I/O.
+// It can't be moved to the writer thread, since the emulator keeps changing the state it would be reading.
+// The writer owns the buffer until it's done, so there's no need for a second one;
+// if the writer is still busy when the next auto-save state is due, that one waits a frame.
+static void melonds::savestate::StartAutoSaveState(const string& path) noexcept {
+    ZoneScopedN("melonds::savestate::StartAutoSaveState");
+    if (retro_serialize_size() == 0 || !_autoSaveState.Save()) {
+        // If savestates aren't supported right now (e.g. in DSi mode), or serialization failed...
+        return;
+    }
+
+    _autoSaveWriterDone = false;
+    _autoSaveWriter = Platform::Thread_Create([path] {
+        WriteAutoSaveState(path, _autoSaveState);
+        _autoSaveWriterDone = true;
+    });
+
+    if (!_autoSaveWriter) {
+        // If this build doesn't support threads...
+        WriteAutoSaveState(path, _autoSaveState);
+    }
+}
+
+// Waits for the writer thread (if any) to finish
+static void melonds::savestate::FinishAutoSaveState() noexcept {
+    if (_autoSaveWriter) {
+        ZoneScopedN("melonds::savestate::FinishAutoSaveState");
+        // Joining the thread also releases it
+        Platform::Thread_Wait(_autoSaveWriter);
+        _autoSaveWriter = nullptr;
+    }
+}
+
+// Compresses the state (if possible) and writes it to a temporary file,
+// then renames it over the previous auto-save state
+// so that a crash in the middle of writing can't leave a corrupt state behind
+static bool melonds::savestate::WriteAutoSaveState(const string& path, const StateBuffer& state) noexcept {
+    ZoneScopedN("melonds::savestate::WriteAutoSaveState");
+    vector<uint8_t> compressed(MaxCompressedSize(state.Size()));
+    size_t length = Compress(state.Data(), state.Size(), compressed.data(), compressed.size());
+    const uint8_t* data = length > 0 ? compressed.data() : state.Data();
+    if (length == 0) {
+        // If compression failed or isn't available, the uncompressed state can still be loaded
+        length = state.Size();
+    }
+
+    string temp_path = path + ".tmp";
+    if (!filestream_write_file(temp_path.c_str(), data, length)) {
+        retro::error("Failed to write auto-save state to \"%s\"", temp_path.c_str());
+        return false;
+    }
+
+    if (filestream_rename(temp_path.c_str(), path.c_str()) != 0) {
+        // Some platforms (e.g. Windows) can't rename over an existing file
+        filestream_delete(path.c_str());
+        if (filestream_rename(temp_path.c_str(), path.c_str()) != 0) {
+            retro::error("Failed to move auto-save state to \"%s\"", path.c_str());
+            return false;
+        }
+    }
+
+    retro::debug("Wrote %zuB auto-save state to \"%s\"", length, path.c_str());
+    return true;
+}
+
+static size_t melonds::savestate::ChunkCount(size_t size, size_t chunkSize) noexcept {
+    return (size + chunkSize - 1) / chunkSize;
+}
+
+// Same as zlib's compressBound
+static size_t melonds::savestate::ChunkBound(size_t size) noexcept {
+    return size + (size >> 12) + (size >> 14) + (size >> 25) + 13;
+}
+
+// Calls fn(0)...fn(count - 1) across the worker pool and this thread, returning once they've all finished.
+// Runs everything on this thread if the core was built without thread support,
+// or if another thread is already using the pool.
+static void melonds::savestate::ParallelFor(size_t count, const std::function<void(size_t)>& fn) noexcept {
+    if (count > 1 && !_poolBusy.test_and_set(std::memory_order_acquire)) {
+        // If there's more than one job and no one else is using the pool...
+        if (!_workersStarted) {
+            StartWorkers();
+        }
+
+        if (!_workers.empty()) {
+            _job = &fn;
+            _jobCount = count;
+            _jobNext = 0;
+
+            int helpers = static_cast<int>(std::min(count - 1, _workers.size()));
+            Platform::Semaphore_Post(_workAvailable, helpers);
+            RunJob();
+            for (int i = 0; i < helpers; ++i) {
+                Platform::Semaphore_Wait(_workDone);
+            }
+
+            _job = nullptr;
+            _poolBusy.clear(std::memory_order_release);
+            return;
+        }
+
+        _poolBusy.clear(std::memory_order_release);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        fn(i);
+    }
+}
+
+// Only called by the thread that holds _poolBusy
+static void melonds::savestate::StartWorkers() noexcept {
+    ZoneScopedN("melonds::savestate::StartWorkers");
+    _workersStarted = true;
+    unsigned helpers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    if (helpers == 0) {
+        return;
+    }
+
+    _workAvailable = Platform::Semaphore_Create();
+    _workDone = Platform::Semaphore_Create();
+    if (!_workAvailable || !_workDone) {
+        // If this build doesn't support threads...
+        return;
+    }
+
+    _workers.reserve(helpers);
+    for (unsigned i = 0; i < helpers; ++i) {
+        if (Platform::Thread* worker = Platform::Thread_Create(WorkerMain)) {
+            _workers.push_back(worker);
+        }
+    }
+
+    retro::debug("Started %zu savestate compression threads", _workers.size());
+}
+
+static void melonds::savestate::WorkerMain() noexcept {
+    while (true) {
+        Platform::Semaphore_Wait(_workAvailable);
+        if (_stopWorkers) {
+            return;
+        }
+
+        RunJob();
+        Platform::Semaphore_Post(_workDone, 1);
+    }
+}
+
+static void melonds::savestate::RunJob() noexcept {
+    for (size_t i = _jobNext++; i < _jobCount; i = _jobNext++) {
+        (*_job)(i);
+    }
+}
@@ -0,0 +1,84 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef MELONDS_DS_SAVESTATE_HPP
+#define MELONDS_DS_SAVESTATE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "retro/task_queue.hpp"
+
+struct retro_game_info;
+
+//! Helpers for the savestate formats we give to the frontend.
+
+namespace melonds::savestate {
+    /// Stops the threads that compress and decompress savestates, if they were started.
+    /// Only call this when no savestate is being compressed or decompressed.
+    void deinit() noexcept;
+
+    /// Precedes the chunk index and the deflated chunks in a compressed container.
+    /// melonDS's own savestates start with "MELN", so the two can't be confused.
+    struct CompressedHeader {
+        char Magic[4]; // "MDSZ"
+        uint32_t Version;
+        uint32_t UncompressedSize;
+
+        /// The size of everything after this header, including the chunk index.
+        uint32_t CompressedSize;
+
+        /// The uncompressed size of each chunk except the last, which may be smaller.
+        uint32_t ChunkSize;
+    };
+
+    /// True if the frontend is asking for a savestate that won't leave this process
+    /// (e.g. for run-ahead), so it should be made as quickly as possible.
+    [[nodiscard]] bool IsFastSavestate() noexcept;
+
+    /// The most space that a compressed container could need for a savestate of the given size,
+    /// including the header.
+    [[nodiscard]] size_t MaxCompressedSize(size_t size) noexcept;
+
+    /// Compresses a savestate into a container at \c output, using all available cores.
+    /// \returns The size of the container, or 0 if it didn't fit or compression isn't available.
+    size_t Compress(const uint8_t* state, size_t size, uint8_t* output, size_t capacity) noexcept;
+
+    [[nodiscard]] bool IsCompressed(const void* data, size_t size) noexcept;
+
+    /// Decompresses a container made by Compress into \c state, resizing it as needed.
+    /// Uses all available cores.
+    /// \param maxSize The largest uncompressed state to accept;
+    /// containers that claim to hold more are rejected before anything is allocated.
+    bool Decompress(const void* data, size_t size, size_t maxSize, std::vector<uint8_t>& state) noexcept;
+
+    /// Periodically saves the emulator state to the save directory, as configured by the user,
+    /// and saves it once more when the game is unloaded.
+    /// Only the snapshot is taken on the emulation thread; compressing and writing it happen on another.
+    /// The snapshot is one NDS::DoSavestate pass into a reused buffer, not a single memcpy,
+    /// since melonDS has no contiguous copy of its state to take.
+    retro::task::TaskSpec AutoSaveStateTask(const retro_game_info& nds_info) noexcept;
+
+    /// Loads the state that AutoSaveStateTask last wrote for this game, if auto-save states are enabled
+    /// and there is one.
+    /// Call on the first frame, after the frontend's save data has been given to the cart,
+    /// since the state includes the save data as it was when the state was written.
+    /// \returns true if a state was loaded.
+    bool LoadAutoSaveState(const retro_game_info& nds_info) noexcept;
+}
+
+#endif //MELONDS_DS_SAVESTATE_HPP
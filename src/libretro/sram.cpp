@@ -16,10 +16,16 @@
 
 #include "sram.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <iterator>
+#include <map>
 #include <memory>
 #include <optional>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include <file/file_path.h>
 #include <retro_assert.h>
@@ -35,91 +41,261 @@
 #include "content.hpp"
 #include "environment.hpp"
 #include "exceptions.hpp"
+#include "file.hpp"
 #include "libretro.hpp"
 #include "retro/task_queue.hpp"
 #include "tracy.hpp"
 
 using std::optional;
 using std::nullopt;
-using std::unique_ptr;
-using std::make_unique;
 using std::string;
 using std::string_view;
 
-unique_ptr<melonds::sram::SaveManager> melonds::sram::NdsSaveManager;
-unique_ptr<melonds::sram::SaveManager> melonds::sram::GbaSaveManager;
+// The NDS save data that the frontend loads and saves through retro_get_memory_data.
+// Allocated once per game and never resized, so that the pointer the frontend caches stays valid;
+// the cart's own save memory can be replaced (e.g. by loading a state), so it's kept in sync by copying.
+static std::vector<u8> NdsSave;
+
+static u8* GbaSram = nullptr;
+static u32 GbaSramLength = 0;
+
+// True if the GBA SRAM was loaded from an rzip-compressed file, so that it's saved the same way
+static bool GbaSramCompressed = false;
+
+// Owned by the writer thread while one is running
+static std::vector<u8> GbaSramSnapshot;
+static Platform::Thread* GbaSramWriter = nullptr;
+static std::atomic_bool GbaSramWriterDone = false;
 static optional<int> TimeToGbaFlush = nullopt;
 static optional<int> TimeToFirmwareFlush = nullopt;
 
+// The parts of the firmware that have changed since it was last flushed,
+// as a set of non-overlapping, non-adjacent [start, end) ranges keyed by start
+static std::map<u32, u32> FirmwareDirtyRanges;
+
+static void MarkFirmwareDirty(u32 start, u32 end) noexcept;
+static void FinishGbaSramWrite() noexcept;
+
 void melonds::sram::init() {
     ZoneScopedN("melonds::sram::init");
-    retro_assert(NdsSaveManager == nullptr);
-    retro_assert(GbaSaveManager == nullptr);
+    retro_assert(NdsSave.empty());
+    retro_assert(GbaSram == nullptr);
+    retro_assert(GbaSramWriter == nullptr);
     TimeToGbaFlush = nullopt;
     TimeToFirmwareFlush = nullopt;
+    FirmwareDirtyRanges.clear();
 }
 
 void melonds::sram::deinit() noexcept {
     ZoneScopedN("melonds::sram::deinit");
-    NdsSaveManager = nullptr;
-    GbaSaveManager = nullptr;
+    ClearNdsSave();
+    FinishGbaSramWrite();
+    ClearGbaSave();
+}
+
+u8* melonds::sram::NdsSaveData() noexcept {
+    return NdsSave.empty() ? nullptr : NdsSave.data();
 }
 
-melonds::sram::SaveManager::SaveManager(u32 initialLength) :
-        _sram(new u8[initialLength]),
-        _sram_length(initialLength) {
+u32 melonds::sram::NdsSaveLength() noexcept {
+    return NdsSave.size();
 }
 
-melonds::sram::SaveManager::~SaveManager() {
-    delete[] _sram; // deleting null pointers is a no-op, no need to check
+void melonds::sram::ClearNdsSave() noexcept {
+    std::vector<u8>().swap(NdsSave);
 }
 
-void melonds::sram::SaveManager::Flush(const u8 *savedata, u32 savelen, u32 writeoffset, u32 writelen) {
-    ZoneScopedN("melonds::sram::SaveManager::Flush");
-    if (_sram_length != savelen) {
-        // If we loaded a game with a different SRAM length...
+void melonds::sram::LoadNdsSave() noexcept {
+    ZoneScopedN("melonds::sram::LoadNdsSave");
+    if (NdsSave.empty() || NDSCart::Cart == nullptr) {
+        // If there's no NDS cart with save memory (e.g. a homebrew ROM or DSiWare)...
+        return;
+    }
 
-        delete[] _sram;
+    // The cart copies the save data into its own save memory
+    NDS::LoadSave(NdsSave.data(), NdsSave.size());
+    RefreshSaveMemory();
+}
 
-        _sram_length = savelen;
-        _sram = new u8[_sram_length];
+void melonds::sram::SyncNdsSave() noexcept {
+    ZoneScopedN("melonds::sram::SyncNdsSave");
+    if (NdsSave.empty() || NDSCart::Cart == nullptr) {
+        return;
+    }
 
-        memcpy(_sram, savedata, _sram_length);
-    } else {
-        if ((writeoffset + writelen) > savelen) {
-            // If the write goes past the end of the SRAM, we have to wrap around
-            u32 len = savelen - writeoffset;
-            memcpy(_sram + writeoffset, savedata + writeoffset, len);
-            len = writelen - len;
-            if (len > savelen) len = savelen;
-            memcpy(_sram, savedata, len);
-        } else {
-            memcpy(_sram + writeoffset, savedata + writeoffset, writelen);
+    const u8* nds_sram = NDSCart::Cart->GetSaveMemory();
+    u32 nds_sram_length = NDSCart::Cart->GetSaveMemoryLength();
+    if (nds_sram == nullptr) {
+        return;
+    }
+
+    if (nds_sram_length != NdsSave.size()) {
+        // If the cart's save memory changed size (e.g. it loaded a state from a different save)...
+        // the frontend's buffer can't change size along with it, so copy what fits
+        retro::warn("NDS save memory is now %u bytes, but the frontend expects %zu", nds_sram_length, NdsSave.size());
+    }
+
+    memcpy(NdsSave.data(), nds_sram, std::min<size_t>(nds_sram_length, NdsSave.size()));
+}
+
+void melonds::sram::RefreshSaveMemory() noexcept {
+    if (GbaSram && GBACart::Cart) {
+        // If we're flushing the GBA cart's save memory...
+        u8* gba_sram = GBACart::Cart->GetSaveMemory();
+        u32 gba_sram_length = GBACart::Cart->GetSaveMemoryLength();
+        if (gba_sram != GbaSram || gba_sram_length != GbaSramLength) {
+            // If the cart replaced its save memory...
+            retro::warn("GBA save memory was replaced, from %u bytes to %u", GbaSramLength, gba_sram_length);
+            GbaSram = gba_sram_length > 0 ? gba_sram : nullptr;
+            GbaSramLength = GbaSram ? gba_sram_length : 0;
         }
     }
 }
 
-static void FlushGbaSram(retro::task::TaskHandle &task, const retro_game_info& gba_save_info) noexcept {
-    ZoneScopedN("melonds::sram::FlushSram");
-    using namespace melonds;
-    const char* save_data_path = gba_save_info.path;
-    if (save_data_path == nullptr || sram::GbaSaveManager == nullptr) {
-        // No save data path was provided, or the GBA save manager isn't initialized
-        return; // TODO: Report this error
+u32 melonds::sram::GbaSaveLength() noexcept {
+    return GbaSramLength;
+}
+
+void melonds::sram::ClearGbaSave() noexcept {
+    retro_assert(GbaSramWriter == nullptr);
+    GbaSram = nullptr;
+    GbaSramLength = 0;
+    GbaSramCompressed = false;
+    std::vector<u8>().swap(GbaSramSnapshot);
+}
+
+// Writes the GBA SRAM to a temporary file in the same format it was loaded in,
+// syncs it to disk, then renames it over the existing file
+// so that a failed write (or a power loss) can't corrupt the player's save.
+// Safe to call from any thread, since it only touches the given data.
+static bool WriteGbaSram(const string& path, const std::vector<u8>& data, bool compressed) noexcept {
+    ZoneScopedN("melonds::sram::WriteGbaSram");
+    string tempPath = path + ".tmp";
+    bool written = compressed
+        ? rzipstream_write_file(tempPath.c_str(), data.data(), data.size())
+        : filestream_write_file(tempPath.c_str(), data.data(), data.size());
+
+    if (!written) {
+        retro::error("Failed to write %zu-byte GBA SRAM to \"%s\"", data.size(), tempPath.c_str());
+        return false;
     }
-    const u8* gba_sram = sram::GbaSaveManager->Sram();
-    u32 gba_sram_length = sram::GbaSaveManager->SramLength();
 
-    if (gba_sram == nullptr || gba_sram_length == 0) {
-        return; // TODO: Report this error
+    if (!melonds::file::Sync(tempPath.c_str())) {
+        // If the new save couldn't be forced to disk (e.g. the frontend's VFS doesn't expose a descriptor),
+        // it's still newer than the old one, so use it anyway
+        retro::warn("Failed to sync GBA SRAM in \"%s\" to disk; it may not survive a power loss", tempPath.c_str());
     }
 
-    if (!filestream_write_file(save_data_path, gba_sram, gba_sram_length)) {
-        retro::error("Failed to write %u-byte GBA SRAM to \"%s\"", gba_sram_length, save_data_path);
-        // TODO: Report this to the user
+    if (filestream_rename(tempPath.c_str(), path.c_str()) != 0) {
+        // Some platforms (e.g. Windows) can't rename over an existing file
+        filestream_delete(path.c_str());
+        if (filestream_rename(tempPath.c_str(), path.c_str()) != 0) {
+            retro::error("Failed to move GBA SRAM from \"%s\" to \"%s\"", tempPath.c_str(), path.c_str());
+            return false;
+        }
+    }
+
+    retro::debug("Flushed %zu-byte %sGBA SRAM to \"%s\"", data.size(), compressed ? "rzip-compressed " : "", path.c_str());
+    return true;
+}
+
+// Waits for the GBA SRAM writer thread (if any) to finish
+static void FinishGbaSramWrite() noexcept {
+    if (GbaSramWriter) {
+        ZoneScopedN("melonds::sram::FinishGbaSramWrite");
+        // Joining the thread also releases it
+        Platform::Thread_Wait(GbaSramWriter);
+        GbaSramWriter = nullptr;
+    }
+}
+
+// Copies the GBA SRAM on this thread, then writes the copy to disk on another
+static void StartGbaSramWrite(const string& path) noexcept {
+    ZoneScopedN("melonds::sram::StartGbaSramWrite");
+    if (GbaSram == nullptr || GbaSramLength == 0) {
+        return;
+    }
+
+    GbaSramSnapshot.assign(GbaSram, GbaSram + GbaSramLength);
+    GbaSramWriterDone = false;
+    GbaSramWriter = Platform::Thread_Create([path, compressed=GbaSramCompressed] {
+        WriteGbaSram(path, GbaSramSnapshot, compressed);
+        GbaSramWriterDone = true;
+    });
+
+    if (!GbaSramWriter) {
+        // If this build doesn't support threads...
+        WriteGbaSram(path, GbaSramSnapshot, GbaSramCompressed);
+    }
+}
+
+// Writes only the changed parts of the firmware into the existing file.
+// Returns false if the file doesn't exist or doesn't match the firmware's size,
+// in which case nothing was written.
+static bool WriteFirmwareRanges(const char* path, const SPI_Firmware::Firmware& firmware) noexcept {
+    ZoneScopedN("melonds::sram::WriteFirmwareRanges");
+    RFILE* file = filestream_open(
+        path,
+        RETRO_VFS_FILE_ACCESS_READ_WRITE | RETRO_VFS_FILE_ACCESS_UPDATE_EXISTING,
+        RETRO_VFS_FILE_ACCESS_HINT_NONE
+    );
+    if (!file) {
+        // If the file doesn't exist (or can't be opened)...
+        return false;
+    }
+
+    if (filestream_get_size(file) != firmware.Length()) {
+        // If the file on disk isn't the same size as the firmware we've been emulating...
+        filestream_close(file);
+        return false;
+    }
+
+    bool ok = true;
+    size_t written = 0;
+    for (const auto& [start, end] : FirmwareDirtyRanges) {
+        int64_t length = end - start;
+        if (filestream_seek(file, start, RETRO_VFS_SEEK_POSITION_START) < 0 ||
+            filestream_write(file, firmware.Buffer() + start, length) != length) {
+            ok = false;
+            break;
+        }
+        written += length;
+    }
+
+    if (filestream_close(file) != 0) {
+        ok = false;
+    }
+
+    if (ok) {
+        retro::debug("Flushed %zu changed bytes in %zu range(s) of the firmware to \"%s\"", written, FirmwareDirtyRanges.size(), path);
     } else {
-        retro::debug("Flushed %u-byte GBA SRAM to \"%s\"", gba_sram_length, save_data_path);
+        retro::error("Failed to update the firmware in \"%s\"; rewriting it", path);
+    }
+
+    return ok;
+}
+
+// Writes the entire firmware to a temporary file, then renames it over the existing file
+// so that a failed write can't leave a corrupt firmware behind
+static bool WriteFirmwareAtomically(const char* path, const SPI_Firmware::Firmware& firmware) noexcept {
+    ZoneScopedN("melonds::sram::WriteFirmwareAtomically");
+    string tempPath = string(path) + ".tmp";
+    if (!filestream_write_file(tempPath.c_str(), firmware.Buffer(), firmware.Length())) {
+        retro::error("Failed to write %u-byte firmware to \"%s\"", firmware.Length(), tempPath.c_str());
+        return false;
     }
+
+    if (filestream_rename(tempPath.c_str(), path) != 0) {
+        // Some platforms (e.g. Windows) can't rename over an existing file
+        filestream_delete(path);
+        if (filestream_rename(tempPath.c_str(), path) != 0) {
+            retro::error("Failed to move firmware from \"%s\" to \"%s\"", tempPath.c_str(), path);
+            return false;
+        }
+    }
+
+    retro::debug("Flushed %u-byte firmware to \"%s\"", firmware.Length(), path);
+    return true;
 }
 
 static void FlushFirmware(string_view firmwarePath) noexcept {
@@ -138,30 +314,83 @@ static void FlushFirmware(string_view firmwarePath) noexcept {
 
     // TODO: mimic melonds's behaviors
 
-    if (!filestream_write_file(firmwarePath.data(), firmware->Buffer(), firmware->Length())) {
-        retro::error("Failed to write %u-byte firmware to \"%.*s\"", firmware->Length(), firmwarePath.length(), firmwarePath.data());
-    } else {
-        retro::debug("Flushed %u-byte firmware to \"%.*s\"", firmware->Length(), firmwarePath.length(), firmwarePath.data());
+    // string_view isn't guaranteed to be null-terminated
+    string path(firmwarePath);
+    if (FirmwareDirtyRanges.empty() && path_is_valid(path.c_str())) {
+        // If the firmware hasn't changed and it's already on disk...
+        return;
+    }
+
+    if (FirmwareDirtyRanges.empty() || !WriteFirmwareRanges(path.c_str(), *firmware)) {
+        // If the file doesn't exist yet (e.g. because we're using built-in firmware),
+        // or if we couldn't update it in place...
+        if (!WriteFirmwareAtomically(path.c_str(), *firmware)) {
+            return;
+        }
     }
+
+    FirmwareDirtyRanges.clear();
+}
+
+// Adds [start, end) to the dirty ranges, merging it with any ranges it overlaps or touches
+static void MarkFirmwareDirty(u32 start, u32 end) noexcept {
+    if (start >= end) {
+        return;
+    }
+
+    auto it = FirmwareDirtyRanges.upper_bound(start);
+    if (it != FirmwareDirtyRanges.begin() && std::prev(it)->second >= start) {
+        // If the range before this one overlaps or touches it...
+        --it;
+        start = it->first;
+        end = std::max(end, it->second);
+        it = FirmwareDirtyRanges.erase(it);
+    }
+
+    while (it != FirmwareDirtyRanges.end() && it->first <= end) {
+        // Absorb any ranges that start inside this one
+        end = std::max(end, it->second);
+        it = FirmwareDirtyRanges.erase(it);
+    }
+
+    FirmwareDirtyRanges.emplace(start, end);
 }
 
 // This task keeps running for the lifetime of the task queue.
 retro::task::TaskSpec melonds::sram::FlushGbaSramTask(const retro_game_info& gba_save_info) noexcept {
     retro::task::TaskSpec task(
-        [info=gba_save_info](retro::task::TaskHandle &task) noexcept {
+        [path=string(gba_save_info.path)](retro::task::TaskHandle &task) noexcept {
             ZoneScopedN("melonds::sram::FlushGbaSramTask");
 
+            if (GbaSramWriter && GbaSramWriterDone) {
+                // If the last flush has been written...
+                FinishGbaSramWrite();
+            }
+
             if (TimeToGbaFlush != nullopt && (*TimeToGbaFlush)-- <= 0) {
                 // If it's time to flush the GBA's SRAM...
+                if (GbaSramWriter) {
+                    // If the last flush is somehow still being written, try again next frame
+                    TimeToGbaFlush = 0;
+                    return;
+                }
+
                 retro::debug("GBA SRAM flush timer expired, flushing save data now");
-                FlushGbaSram(task, info);
+                StartGbaSramWrite(path);
                 TimeToGbaFlush = nullopt; // Reset the timer
             }
         },
         nullptr,
-        [info=gba_save_info](retro::task::TaskHandle& task) noexcept {
+        [path=string(gba_save_info.path)](retro::task::TaskHandle& task) noexcept {
             ZoneScopedN("melonds::sram::FlushGbaSramTask::Cleanup");
-            FlushGbaSram(task, info);
+            FinishGbaSramWrite();
+
+            if (TimeToGbaFlush != nullopt && GbaSram != nullptr) {
+                // If the SRAM changed since it was last flushed, write it now;
+                // no need for a separate thread, since the game is being unloaded anyway
+                GbaSramSnapshot.assign(GbaSram, GbaSram + GbaSramLength);
+                WriteGbaSram(path, GbaSramSnapshot, GbaSramCompressed);
+            }
             TimeToGbaFlush = nullopt;
         }
     );
@@ -219,13 +448,19 @@ void melonds::sram::InitNdsSave(const NdsCart &nds_cart) {
         u32 sram_length = nds_cart.GetSaveMemoryLength();
 
         if (sram_length > 0) {
-            sram::NdsSaveManager = make_unique<SaveManager>(sram_length);
-            retro::log(RETRO_LOG_DEBUG, "Allocated %u-byte SRAM buffer for loaded NDS ROM.", sram_length);
+            // Start with the cart's blank save memory, in case the frontend has no save to load
+            const u8* sram = nds_cart.GetSaveMemory();
+            if (sram) {
+                NdsSave.assign(sram, sram + sram_length);
+            } else {
+                NdsSave.assign(sram_length, 0xFF);
+            }
+            retro::log(RETRO_LOG_DEBUG, "Exposing %u-byte SRAM buffer of loaded NDS ROM to the frontend.", sram_length);
         } else {
             retro::log(RETRO_LOG_DEBUG, "Loaded NDS ROM does not use SRAM.");
         }
-        // The actual SRAM file is installed later; it's loaded into the core via retro_get_memory_data,
-        // and it's applied in the first frame of retro_run.
+        // The actual SRAM file is loaded into this buffer by the frontend via retro_get_memory_data,
+        // then handed to the cart before the first frame.
     }
 }
 
@@ -251,28 +486,15 @@ void melonds::sram::InitGbaSram(GbaCart& gba_cart, const struct retro_game_info&
         return;
     }
 
-    // rzipstream opens the file as-is if it's not rzip-formatted
+    // rzipstream opens the file as-is if it's not rzip-formatted,
+    // and transparently decompresses it if it is
+    // (libretro's rzip format, not to be confused with a standard archive format like zip or 7z)
     rzipstream_t* gba_save_file = rzipstream_open(gba_save_info.path, RETRO_VFS_FILE_ACCESS_READ);
     if (!gba_save_file) {
         throw std::runtime_error("Failed to open GBA save file");
     }
 
-    if (rzipstream_is_compressed(gba_save_file)) {
-        // If this save data is compressed in libretro's rzip format...
-        // (not to be confused with a standard archive format like zip or 7z)
-
-        // We don't support rzip-compressed GBA save files right now;
-        // I can't be bothered.
-        retro::set_error_message(
-                "melonDS DS does not support compressed GBA save data right now. "
-                "Please disable save data compression in the frontend and try again. "
-                "Continuing without using the save data."
-        );
-
-        rzipstream_close(gba_save_file);
-        return;
-    }
-
+    bool compressed = rzipstream_is_compressed(gba_save_file);
     int64_t gba_save_file_size = rzipstream_get_size(gba_save_file);
     if (gba_save_file_size < 0) {
         // If we couldn't get the uncompressed size of the GBA save file...
@@ -280,46 +502,66 @@ void melonds::sram::InitGbaSram(GbaCart& gba_cart, const struct retro_game_info&
         throw std::runtime_error("Failed to get GBA save file size");
     }
 
-    void* gba_save_data = malloc(gba_save_file_size);
-    if (!gba_save_data) {
+    // Allocates the cart's save memory, and determines the save type from its size
+    gba_cart.SetupSave(gba_save_file_size);
+    u8* gba_sram = gba_cart.GetSaveMemory();
+    u32 gba_sram_length = gba_cart.GetSaveMemoryLength();
+    if (gba_sram == nullptr || gba_sram_length == 0) {
+        // If the save file's size doesn't correspond to any known save type...
         rzipstream_close(gba_save_file);
-        throw std::runtime_error("Failed to allocate memory for GBA save file");
+        retro::set_error_message(
+                "melonDS DS does not recognize the size of this GBA save data. "
+                "Continuing without using the save data."
+        );
+        return;
     }
 
-    if (rzipstream_read(gba_save_file, gba_save_data, gba_save_file_size) != gba_save_file_size) {
+    // Read the save data straight into the cart's save memory, rather than into a temporary buffer;
+    // it survives the cart being inserted into the emulator, so it doesn't need to be reinstalled later
+    int64_t length = std::min<int64_t>(gba_save_file_size, gba_sram_length);
+    if (rzipstream_read(gba_save_file, gba_sram, length) != length) {
         rzipstream_close(gba_save_file);
-        free(gba_save_data);
         throw std::runtime_error("Failed to read GBA save file");
     }
-
-    sram::GbaSaveManager = make_unique<SaveManager>(gba_save_file_size);
-    gba_cart.SetupSave(gba_save_file_size);
-    // LoadSave's subclasses will call Platform::WriteGBASave.
-    // The data will be in the buffer soon enough.
-    gba_cart.LoadSave(static_cast<const u8*>(gba_save_data), gba_save_file_size);
-    retro::debug("Allocated %u-byte GBA SRAM", gba_cart.GetSaveMemoryLength());
-    // Actually installing the SRAM will be done later, after NDS::Reset is called
-    free(gba_save_data);
     rzipstream_close(gba_save_file);
+
+    GbaSram = gba_sram;
+    GbaSramLength = gba_sram_length;
+    GbaSramCompressed = compressed;
+    retro::debug("Loaded %u-byte %sGBA SRAM", gba_sram_length, compressed ? "rzip-compressed " : "");
     retro::task::push(sram::FlushGbaSramTask(gba_save_info));
 }
 
 void Platform::WriteNDSSave(const u8 *savedata, u32 savelen, u32 writeoffset, u32 writelen) {
-    // TODO: Implement a Fast SRAM mode where the frontend is given direct access to the SRAM buffer
     ZoneScopedN("Platform::WriteNDSSave");
-    if (melonds::sram::NdsSaveManager) {
-        melonds::sram::NdsSaveManager->Flush(savedata, savelen, writeoffset, writelen);
+    // No need to maintain a flush timer for NDS SRAM,
+    // because retro_get_memory lets us delegate autosave to the frontend.
+    // We just need to copy the changed bytes to the buffer it reads.
+    if (NdsSave.empty() || savedata == nullptr || melonds::IsSpeculating()) {
+        // If there's no buffer to write to, or run-ahead will roll this write back anyway...
+        return;
+    }
 
-        // No need to maintain a flush timer for NDS SRAM,
-        // because retro_get_memory lets us delegate autosave to the frontend.
+    u32 length = std::min<u32>(savelen, NdsSave.size());
+    if (writeoffset >= length) {
+        return;
+    }
+
+    writelen = std::min(writelen, length);
+    if (writeoffset + writelen > length) {
+        // If the write wraps around the end of the save memory...
+        u32 tail = length - writeoffset;
+        memcpy(NdsSave.data() + writeoffset, savedata + writeoffset, tail);
+        memcpy(NdsSave.data(), savedata, writelen - tail);
+    } else {
+        memcpy(NdsSave.data() + writeoffset, savedata + writeoffset, writelen);
     }
 }
 
 void Platform::WriteGBASave(const u8 *savedata, u32 savelen, u32 writeoffset, u32 writelen) {
     ZoneScopedN("Platform::WriteGBASave");
-    if (melonds::sram::GbaSaveManager) {
-        melonds::sram::GbaSaveManager->Flush(savedata, savelen, writeoffset, writelen);
-
+    if (GbaSram && !melonds::IsSpeculating()) {
+        // The write is already in the cart's save memory, which is what we flush.
         // Start the countdown until we flush the SRAM back to disk.
         // The timer resets every time we write to SRAM,
         // so that a sequence of SRAM writes doesn't result in
@@ -330,7 +572,14 @@ void Platform::WriteGBASave(const u8 *savedata, u32 savelen, u32 writeoffset, u3
 
 void Platform::WriteFirmware(const SPI_Firmware::Firmware &firmware, u32 writeoffset) {
     ZoneScopedN("Platform::WriteFirmware");
+    if (melonds::IsSpeculating()) {
+        // Run-ahead will roll this write back, then make it again for real
+        return;
+    }
 
+    // melonDS asks us to flush everything from writeoffset to the end of the firmware
+    // (it's usually the start of the user settings, which are at the end)
+    MarkFirmwareDirty(writeoffset, firmware.Length());
     TimeToFirmwareFlush = melonds::config::save::FlushDelay();
 }
 
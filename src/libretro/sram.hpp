@@ -37,54 +37,42 @@ namespace melonds::sram {
     void InitNdsSave(const NdsCart &nds_cart);
     void InitGbaSram(GbaCart& gba_cart, const struct retro_game_info& gba_save_info);
 
+    /// A copy of the loaded NDS cart's save memory,
+    /// which the frontend loads and saves directly through retro_get_memory_data;
+    /// or nullptr if the cart has no save memory.
+    /// Stays at the same address until the game is unloaded.
+    [[nodiscard]] u8* NdsSaveData() noexcept;
+    [[nodiscard]] u32 NdsSaveLength() noexcept;
+
+    /// Forgets the NDS cart's save memory, which is freed along with the cart.
+    void ClearNdsSave() noexcept;
+
+    /// Passes the save data that the frontend loaded into NdsSaveData() to the cart,
+    /// so that it can do whatever else it needs to when a save is loaded
+    /// (e.g. NAND carts derive their save ID from it).
+    /// Call once, after the cart is inserted and the frontend has loaded the save data.
+    void LoadNdsSave() noexcept;
+
+    /// Re-reads where the inserted carts keep their save memory.
+    /// Call after loading a savestate, since a cart replaces its save memory
+    /// if the state's save data is a different size.
+    void RefreshSaveMemory() noexcept;
+
+    /// Copies the NDS cart's save memory into NdsSaveData().
+    /// Call after loading a savestate that replaces the game's history (e.g. retro_unserialize or rewind),
+    /// since that restores the cart's save memory without going through Platform::WriteNDSSave.
+    /// Not needed after run-ahead rolls back, since the save data it skipped never reached the copy.
+    void SyncNdsSave() noexcept;
+
+    /// The size of the loaded GBA cart's save memory, or 0 if there isn't any.
+    [[nodiscard]] u32 GbaSaveLength() noexcept;
+
+    /// Forgets the GBA cart's save memory, which is freed along with the cart.
+    /// Call only after the GBA SRAM flush task has been cleaned up.
+    void ClearGbaSave() noexcept;
+
     retro::task::TaskSpec FlushGbaSramTask(const retro_game_info& gba_save_info) noexcept;
     retro::task::TaskSpec FlushFirmwareTask(std::string_view path);
-
-    /// An intermediate save buffer used as a staging ground between retro_get_memory and NDSCart::LoadSave.
-    class [[deprecated("Expose the buffers to libretro directly")]] SaveManager {
-    public:
-        SaveManager(u32 initialLength);
-
-        ~SaveManager();
-
-        SaveManager(const SaveManager &) = delete;
-
-        SaveManager(SaveManager &&) = delete;
-
-        SaveManager &operator=(const SaveManager &) = delete;
-
-        /// Signals that SRAM was recently updated.
-        ///
-        /// \param savedata Pointer to the entire SRAM buffer.
-        /// Never changes during a game's lifetime.
-        /// \param savelen Length of the entire SRAM buffer.
-        /// Never changes during a game's lifetime.
-        /// \param writeoffset Starting position of the updated data
-        /// \param writelen Length of the updated data.
-        void Flush(const u8 *savedata, u32 savelen, u32 writeoffset, u32 writelen);
-
-        [[nodiscard]] const u8 *Sram() const {
-            return _sram;
-        }
-
-        u8 *Sram() {
-            return _sram;
-        }
-
-        [[nodiscard]] u32 SramLength() const {
-            return _sram_length;
-        }
-
-    private:
-        u8 *_sram;
-        u32 _sram_length;
-    };
-
-    [[deprecated("Expose the buffers to libretro directly")]]
-    extern std::unique_ptr<SaveManager> NdsSaveManager;
-
-    [[deprecated("Expose the buffers to libretro directly")]]
-    extern std::unique_ptr<SaveManager> GbaSaveManager;
 }
 
 #endif //MELONDS_DS_SRAM_HPP
@@ -0,0 +1,189 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include "statebuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <retro_assert.h>
+#include <NDS.h>
+#include <Savestate.h>
+
+#include "environment.hpp"
+#include "memory.hpp"
+#include "sram.hpp"
+#include "tracy.hpp"
+
+using std::vector;
+
+// The state arena: one block, split into equally-sized slots that each hold one state.
+// Rewind's two states, run-ahead's and the state hash's all live here,
+// so taking them every frame never allocates and they don't end up scattered across the heap.
+namespace melonds::statearena {
+    static vector<uint8_t> _arena;
+    static size_t _slotSize = 0;
+    static vector<bool> _slotsInUse;
+
+    static size_t Claim(size_t size) noexcept;
+    static void Grow(size_t size) noexcept;
+    static void Release(size_t slot) noexcept;
+    static uint8_t* Slot(size_t slot) noexcept;
+}
+
+// Returns a free slot that can hold at least size bytes, adding one if needed
+static size_t melonds::statearena::Claim(size_t size) noexcept {
+    ZoneScopedN("melonds::statearena::Claim");
+    Grow(size);
+
+    auto freeSlot = std::find(_slotsInUse.begin(), _slotsInUse.end(), false);
+    size_t slot = freeSlot - _slotsInUse.begin();
+    if (freeSlot == _slotsInUse.end()) {
+        // If every slot is taken...
+        _slotsInUse.push_back(true);
+        _arena.resize(_slotsInUse.size() * _slotSize);
+        retro::debug("Grew the state arena to %zu slots of %zuB", _slotsInUse.size(), _slotSize);
+    } else {
+        *freeSlot = true;
+    }
+
+    return slot;
+}
+
+// Makes every slot at least size bytes long, keeping each one's contents
+static void melonds::statearena::Grow(size_t size) noexcept {
+    if (size <= _slotSize) {
+        return;
+    }
+
+    ZoneScopedN("melonds::statearena::Grow");
+    vector<uint8_t> arena(_slotsInUse.size() * size);
+    for (size_t slot = 0; slot < _slotsInUse.size(); ++slot) {
+        if (_slotsInUse[slot]) {
+            memcpy(arena.data() + slot * size, _arena.data() + slot * _slotSize, _slotSize);
+        }
+    }
+
+    _arena = std::move(arena);
+    _slotSize = size;
+}
+
+static void melonds::statearena::Release(size_t slot) noexcept {
+    retro_assert(slot < _slotsInUse.size() && _slotsInUse[slot]);
+    _slotsInUse[slot] = false;
+
+    if (std::find(_slotsInUse.begin(), _slotsInUse.end(), true) == _slotsInUse.end()) {
+        // If nothing's using the arena anymore (e.g. the game was unloaded), give back its memory
+        vector<uint8_t>().swap(_arena);
+        _slotsInUse.clear();
+        _slotSize = 0;
+    }
+}
+
+static uint8_t* melonds::statearena::Slot(size_t slot) noexcept {
+    return _arena.data() + slot * _slotSize;
+}
+
+melonds::StateBuffer::StateBuffer(StateBuffer&& other) noexcept :
+    _storage(other._storage),
+    _slot(std::exchange(other._slot, NO_SLOT)),
+    _buffer(std::move(other._buffer)),
+    _length(std::exchange(other._length, 0)) {
+}
+
+melonds::StateBuffer& melonds::StateBuffer::operator=(StateBuffer&& other) noexcept {
+    if (this != &other) {
+        Clear();
+        _storage = other._storage;
+        _slot = std::exchange(other._slot, NO_SLOT);
+        _buffer = std::move(other._buffer);
+        _length = std::exchange(other._length, 0);
+    }
+
+    return *this;
+}
+
+bool melonds::StateBuffer::Save() noexcept {
+    ZoneScopedN("melonds::StateBuffer::Save");
+    size_t capacity = uncompressed_savestate_size();
+    if (capacity == 0) {
+        // If melonDS can't serialize the emulated console...
+        _length = 0;
+        return false;
+    }
+
+    // Only allocates when a game is first loaded (or the savestate bound grows),
+    // not on every save
+    uint8_t* data;
+    if (_storage == StateStorage::Arena) {
+        if (_slot == NO_SLOT) {
+            _slot = statearena::Claim(capacity);
+        } else {
+            statearena::Grow(capacity);
+        }
+        data = statearena::Slot(_slot);
+    } else {
+        if (_buffer.size() != capacity) {
+            _buffer.resize(capacity);
+        }
+        data = _buffer.data();
+    }
+
+    Savestate state(data, capacity, true);
+    if (!NDS::DoSavestate(&state) || state.Error) {
+        retro::error("Failed to save a %zuB state", capacity);
+        _length = 0;
+        return false;
+    }
+
+    _length = state.Length();
+    return true;
+}
+
+bool melonds::StateBuffer::Load() const noexcept {
+    ZoneScopedN("melonds::StateBuffer::Load");
+    if (_length == 0) {
+        return false;
+    }
+
+    // Savestate's constructor doesn't modify the buffer when loading
+    Savestate state(const_cast<uint8_t*>(Data()), _length, false);
+    bool loaded = NDS::DoSavestate(&state) && !state.Error;
+    sram::RefreshSaveMemory();
+    return loaded;
+}
+
+void melonds::StateBuffer::Clear() noexcept {
+    _length = 0;
+    if (_slot != NO_SLOT) {
+        statearena::Release(_slot);
+        _slot = NO_SLOT;
+    }
+    vector<uint8_t>().swap(_buffer);
+}
+
+const uint8_t* melonds::StateBuffer::Data() const noexcept {
+    if (_slot != NO_SLOT) {
+        return statearena::Slot(_slot);
+    }
+
+    return _buffer.data();
+}
+
+uint8_t* melonds::StateBuffer::Data() noexcept {
+    return const_cast<uint8_t*>(std::as_const(*this).Data());
+}
@@ -0,0 +1,81 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef MELONDS_DS_STATEBUFFER_HPP
+#define MELONDS_DS_STATEBUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//! Reusable buffers for emulator states that never leave this process.
+
+namespace melonds {
+    /// Where a StateBuffer keeps its state.
+    enum class StateStorage {
+        /// In a slot of the state arena, a single block shared by every such buffer.
+        /// The arena may move whenever a buffer first saves into it,
+        /// so these buffers may only be used on the emulation thread.
+        Arena,
+
+        /// In a block of its own, which only moves when this buffer's state outgrows it.
+        /// For states that are read from another thread (e.g. the auto-save state writer).
+        Owned,
+    };
+
+    /// Holds an emulator state for a feature that takes one every frame (e.g. rewind or run-ahead).
+    /// The memory is allocated once and reused until Clear is called,
+    /// and the state isn't padded or compressed like the ones given to the frontend.
+    /// Saving and loading still go through melonDS's NDS::DoSavestate,
+    /// so each one costs about as much as serializing the state normally does;
+    /// the arena only keeps the per-frame states together in one allocation that outlives any one buffer.
+    class StateBuffer {
+    public:
+        explicit StateBuffer(StateStorage storage = StateStorage::Arena) noexcept : _storage(storage) {}
+        StateBuffer(StateBuffer&& other) noexcept;
+        StateBuffer& operator=(StateBuffer&& other) noexcept;
+        StateBuffer(const StateBuffer&) = delete;
+        StateBuffer& operator=(const StateBuffer&) = delete;
+
+        /// Captures the current emulator state, replacing whatever this buffer held.
+        /// \returns false if savestates aren't supported right now or if serialization failed,
+        /// in which case this buffer is left empty.
+        bool Save() noexcept;
+
+        /// Restores the emulator to this buffer's state.
+        bool Load() const noexcept;
+
+        /// Forgets the state and gives back its memory (or its arena slot).
+        /// Not done on destruction, since these buffers are static and the arena may already be gone by then.
+        void Clear() noexcept;
+
+        [[nodiscard]] bool Empty() const noexcept { return _length == 0; }
+        [[nodiscard]] size_t Size() const noexcept { return _length; }
+
+        /// For arena-backed buffers, only valid until the next time any of them is saved.
+        [[nodiscard]] const uint8_t* Data() const noexcept;
+        [[nodiscard]] uint8_t* Data() noexcept;
+    private:
+        static constexpr size_t NO_SLOT = SIZE_MAX;
+
+        StateStorage _storage;
+        size_t _slot = NO_SLOT;
+        std::vector<uint8_t> _buffer;
+        size_t _length = 0;
+    };
+}
+
+#endif //MELONDS_DS_STATEBUFFER_HPP
@@ -0,0 +1,113 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include "statehash.hpp"
+
+#include <optional>
+#include <string>
+
+#include <file/file_path.h>
+#include <retro_miscellaneous.h>
+#include <streams/file_stream.h>
+
+#include <NDS.h>
+
+#include "environment.hpp"
+#include "statebuffer.hpp"
+#include "tracy.hpp"
+#include "xxhash64.hpp"
+
+namespace melonds::statehash {
+    constexpr const char* const TRACE_FILE_NAME = "melonDS DS state hashes.txt";
+
+    static bool _traceEnabled = false;
+    static RFILE* _traceFile = nullptr;
+    static StateBuffer _state;
+
+    static void OpenTrace() noexcept;
+    static void CloseTrace() noexcept;
+}
+
+std::optional<uint64_t> melonds::statehash::HashState() noexcept {
+    ZoneScopedN("melonds::statehash::HashState");
+    if (!_state.Save()) {
+        return std::nullopt;
+    }
+
+    return XXHash64(_state.Data(), _state.Size());
+}
+
+void melonds::statehash::SetTraceEnabled(bool enabled) noexcept {
+    _traceEnabled = enabled;
+    if (!enabled) {
+        CloseTrace();
+        _state.Clear();
+    }
+}
+
+void melonds::statehash::Trace() noexcept {
+    if (!_traceEnabled) {
+        return;
+    }
+
+    ZoneScopedN("melonds::statehash::Trace");
+    std::optional<uint64_t> hash = HashState();
+    if (!hash) {
+        return;
+    }
+
+    if (!_traceFile) {
+        OpenTrace();
+        if (!_traceFile) {
+            return;
+        }
+    }
+
+    filestream_printf(_traceFile, "%u\t%016llx\n", NDS::NumFrames, static_cast<unsigned long long>(*hash));
+}
+
+void melonds::statehash::Reset() noexcept {
+    CloseTrace();
+    _state.Clear();
+}
+
+static void melonds::statehash::OpenTrace() noexcept {
+    ZoneScopedN("melonds::statehash::OpenTrace");
+    const std::optional<std::string>& save_directory = retro::get_save_directory();
+    if (!save_directory) {
+        retro::error("Failed to get save directory; can't trace state hashes");
+        _traceEnabled = false;
+        return;
+    }
+
+    char path[PATH_MAX];
+    fill_pathname_join_special(path, save_directory->c_str(), TRACE_FILE_NAME, sizeof(path));
+    _traceFile = filestream_open(path, RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+    if (!_traceFile) {
+        retro::error("Failed to open state hash trace file \"%s\"", path);
+        _traceEnabled = false;
+        return;
+    }
+
+    retro::info("Tracing state hashes to \"%s\"", path);
+}
+
+static void melonds::statehash::CloseTrace() noexcept {
+    if (_traceFile) {
+        filestream_close(_traceFile);
+        _traceFile = nullptr;
+    }
+}
@@ -0,0 +1,45 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef MELONDS_DS_STATEHASH_HPP
+#define MELONDS_DS_STATEHASH_HPP
+
+#include <cstdint>
+#include <optional>
+
+//! Hashing of the emulator state, for finding where two runs of the same game diverge
+//! (e.g. netplay desyncs, or differences between renderers or code paths).
+
+namespace melonds::statehash {
+    /// Hashes the current emulator state (RAM, VRAM, registers, and everything else in a savestate) with XXH64.
+    /// \returns The hash, or nullopt if melonDS couldn't serialize the emulated console.
+    [[nodiscard]] std::optional<uint64_t> HashState() noexcept;
+
+    /// Starts or stops writing each frame's state hash to a trace file in the save directory.
+    /// Each line of the file holds the frame number and the hash, in hex;
+    /// two traces can be compared with any diff tool to find the first frame that differs.
+    /// Each trace starts over at the next Reset.
+    void SetTraceEnabled(bool enabled) noexcept;
+
+    /// If tracing is enabled, hashes the current state and appends it to the trace file.
+    /// Call once per frame, after the frame has run.
+    void Trace() noexcept;
+
+    /// Closes the trace file (if any) and frees the memory used for hashing.
+    void Reset() noexcept;
+}
+
+#endif //MELONDS_DS_STATEHASH_HPP
@@ -0,0 +1,30 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef MELONDS_DS_XXHASH64_HPP
+#define MELONDS_DS_XXHASH64_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace melonds {
+    /// The 64-bit XXH64 hash of the given data,
+    /// so that hashes can be checked against other tools.
+    /// Reads the data in native byte order, so the results only match other implementations' on little-endian hosts.
+    [[nodiscard]] uint64_t XXHash64(const void* data, size_t size, uint64_t seed = 0) noexcept;
+}
+
+#endif //MELONDS_DS_XXHASH64_HPP
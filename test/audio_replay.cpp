@@ -0,0 +1,200 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+//! Replays an audio capture (as recorded by the "Capture SPU Output" debug option)
+//! through the core's audio path without running the emulator.
+//! Reports how long each frame's Render took and a hash of everything submitted to the frontend,
+//! so that changes to the audio path can be benchmarked on real game audio and diffed bit-for-bit across builds.
+//! Only covers what happens after SPU::ReadOutput; the SPU's own mixing isn't replayed.
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <NDS.h>
+
+#include "audio.hpp"
+#include "audio_stubs.hpp"
+
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    // Longer gaps than this between captured frames mean the capture is corrupt, not that the SPU was quiet
+    constexpr uint32_t MAX_FRAME_GAP = 600;
+
+    struct Options {
+        const char* Capture = nullptr;
+        unsigned Rate = 0;
+        unsigned Repeat = 10;
+    };
+
+    struct Result {
+        size_t Frames = 0;
+        size_t Submitted = 0;
+        double Microseconds = 0;
+        uint64_t Hash = 0;
+        melonds::audio::AudioMetrics Metrics {};
+    };
+
+    bool ParseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+                options.Rate = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+            } else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+                options.Repeat = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+            } else if (argv[i][0] != '-' && !options.Capture) {
+                options.Capture = argv[i];
+            } else {
+                return false;
+            }
+        }
+
+        return options.Capture != nullptr;
+    }
+
+    uint64_t Fnv1a(const vector<int16_t>& samples) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        const auto* bytes = reinterpret_cast<const uint8_t*>(samples.data());
+        for (size_t i = 0; i < samples.size() * sizeof(int16_t); ++i) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+
+        return hash;
+    }
+
+    // Feeds each captured chunk to the stubbed SPU and calls Render once per emulated frame,
+    // including the frames in which the SPU produced nothing.
+    Result Replay(const vector<char>& capture, unsigned rate, bool warn) {
+        using melonds::audio::CaptureRecord;
+        test::audio::Clear();
+        melonds::audio::SetOutputSampleRate(rate);
+
+        Result result;
+        Clock::duration elapsed {};
+        auto render = [&](uint32_t frame) {
+            NDS::NumFrames = frame;
+            Clock::time_point start = Clock::now();
+            melonds::audio::Render();
+            elapsed += Clock::now() - start;
+            result.Frames++;
+        };
+
+        size_t offset = sizeof(melonds::audio::CaptureHeader);
+        bool started = false;
+        uint32_t frame = 0;
+        while (offset + sizeof(CaptureRecord) <= capture.size()) {
+            CaptureRecord record;
+            std::memcpy(&record, &capture[offset], sizeof(record));
+            offset += sizeof(record);
+
+            size_t size = static_cast<size_t>(record.Count) * 2 * sizeof(int16_t);
+            if (size > capture.size() - offset) {
+                // If the capture was cut off partway through this record (e.g. the disk filled up)...
+                if (warn) {
+                    std::fprintf(stderr, "Capture ends partway through frame %" PRIu32 "; ignoring the rest\n", record.Frame);
+                }
+                break;
+            }
+
+            if (started && record.Frame != frame) {
+                if (record.Frame < frame || record.Frame - frame > MAX_FRAME_GAP) {
+                    if (warn) {
+                        std::fprintf(stderr, "Capture jumps from frame %" PRIu32 " to %" PRIu32 "; ignoring the rest\n", frame, record.Frame);
+                    }
+                    break;
+                }
+
+                for (; frame < record.Frame; ++frame) {
+                    render(frame);
+                }
+            }
+
+            started = true;
+            frame = record.Frame;
+            vector<int16_t> frames(record.Count * 2);
+            std::memcpy(frames.data(), &capture[offset], size);
+            test::audio::QueueSpuOutput(frames.data(), record.Count);
+            offset += size;
+        }
+
+        if (started) {
+            render(frame);
+        }
+
+        result.Microseconds = std::chrono::duration<double, std::micro>(elapsed).count();
+        result.Submitted = test::audio::Submitted().size() / 2;
+        result.Hash = Fnv1a(test::audio::Submitted());
+        result.Metrics = melonds::audio::Metrics();
+        return result;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "Usage: %s [--rate HZ] [--repeat N] capture.bin\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream file(options.Capture, std::ios::binary);
+    vector<char> capture;
+    if (file) {
+        capture.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    melonds::audio::CaptureHeader header {};
+    if (!file || capture.size() < sizeof(header)) {
+        std::fprintf(stderr, "Failed to read \"%s\"\n", options.Capture);
+        return 1;
+    }
+
+    std::memcpy(&header, capture.data(), sizeof(header));
+    if (std::memcmp(header.Magic, "MDSA", sizeof(header.Magic)) != 0 || header.Version != 1) {
+        std::fprintf(stderr, "\"%s\" isn't a version 1 audio capture\n", options.Capture);
+        return 1;
+    }
+
+    Result first;
+    vector<double> times;
+    for (unsigned i = 0; i < options.Repeat; ++i) {
+        Result result = Replay(capture, options.Rate, i == 0);
+        if (i == 0) {
+            first = result;
+        } else if (result.Hash != first.Hash) {
+            std::fprintf(stderr, "Replay %u produced different output than the first; the audio path isn't deterministic\n", i);
+            return 1;
+        }
+
+        times.push_back(result.Microseconds / std::max<size_t>(result.Frames, 1));
+    }
+
+    std::sort(times.begin(), times.end());
+    std::printf(
+        "%zu frames at %uHz: %zu frames submitted, hash %016" PRIx64 ", %u underruns, %u overruns\n",
+        first.Frames, melonds::audio::OutputSampleRate(), first.Submitted, first.Hash, first.Metrics.Underruns, first.Metrics.Overruns
+    );
+    std::printf("Render: %.2fus/frame median, %.2fus/frame best of %u\n", times[times.size() / 2], times.front(), options.Repeat);
+    return 0;
+}
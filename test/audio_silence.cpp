@@ -0,0 +1,186 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+//! Checks that skipping the resampler while the audio ring holds only silence
+//! doesn't change a single output sample, at the SPU's native rate and at the resampled ones.
+//! Drives audio.cpp on its own, with the SPU and the frontend stubbed out,
+//! then reports how much time the shortcut saves on a silent stretch.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include <NDS.h>
+
+#include "audio.hpp"
+#include "audio_stubs.hpp"
+
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    // What the stubbed SPU hands out, looping at the end
+    vector<int16_t> _signal;
+    size_t _signalPosition = 0;
+
+    void QueueSignal(size_t count) {
+        size_t signalFrames = _signal.size() / 2;
+        while (count > 0) {
+            size_t chunk = std::min(count, signalFrames - _signalPosition);
+            test::audio::QueueSpuOutput(&_signal[_signalPosition * 2], chunk);
+            _signalPosition = (_signalPosition + chunk) % signalFrames;
+            count -= chunk;
+        }
+    }
+
+    // Tones, noise and single-sample blips, separated by silent stretches of various lengths,
+    // so that the ring flips between silent and audible with the silence boundary at all sorts of positions
+    vector<int16_t> MakeSignal() {
+        vector<int16_t> signal;
+        uint32_t noise = 0x2545F491;
+        auto append = [&](size_t frames, int kind) {
+            for (size_t i = 0; i < frames; ++i) {
+                int16_t left = 0;
+                int16_t right = 0;
+                switch (kind) {
+                    case 1:
+                        left = static_cast<int16_t>(8000 * std::sin(i * 0.05));
+                        right = static_cast<int16_t>(6000 * std::sin(i * 0.031));
+                        break;
+                    case 2:
+                        noise ^= noise << 13;
+                        noise ^= noise >> 17;
+                        noise ^= noise << 5;
+                        left = static_cast<int16_t>(noise & 0x3FFF);
+                        right = static_cast<int16_t>((noise >> 16) & 0x3FFF);
+                        break;
+                    case 3:
+                        // A lone sample on one channel
+                        left = (i == frames / 2) ? 1 : 0;
+                        break;
+                    default:
+                        break;
+                }
+                signal.push_back(left);
+                signal.push_back(right);
+            }
+        };
+
+        append(32768, 1);
+        append(65536, 0);
+        append(16384, 2);
+        append(3, 0);
+        append(500, 1);
+        append(40000, 0);
+        append(7, 3);
+        append(20000, 0);
+        append(1, 3);
+        append(90000, 0);
+        append(8000, 2);
+        append(1234, 0);
+        return signal;
+    }
+
+    // Runs the given number of frames through melonds::audio and returns what it submitted.
+    // The SPU's output arrives unevenly from frame to frame, and now and then not at all,
+    // so that the ring also underruns and has to re-prime.
+    vector<int16_t> Run(unsigned rate, bool skip, size_t frames, size_t& skipped) {
+        _signalPosition = 0;
+        test::audio::Clear();
+        melonds::audio::SetSilenceSkipping(skip);
+        melonds::audio::SetOutputSampleRate(rate);
+
+        double owed = 0;
+        for (size_t frame = 0; frame < frames; ++frame) {
+            NDS::NumFrames = static_cast<u32>(frame);
+            owed += melonds::audio::SAMPLE_RATE / melonds::audio::FPS;
+            if (frame % 97 == 13) {
+                // The SPU produced nothing this frame; it'll catch up on the next one
+            } else {
+                size_t jitter = (frame * 7919) % 64;
+                size_t count = static_cast<size_t>(owed) > jitter ? static_cast<size_t>(owed) - jitter : 0;
+                QueueSignal(count);
+                owed -= count;
+            }
+
+            melonds::audio::Render();
+        }
+
+        skipped = melonds::audio::Metrics().SkippedFrames;
+        return test::audio::Submitted();
+    }
+
+    double TimeSilence(unsigned rate, bool skip, size_t frames) {
+        vector<int16_t> signal = std::move(_signal);
+        _signal.assign(4096 * 2, 0);
+        size_t skipped;
+
+        Clock::time_point start = Clock::now();
+        Run(rate, skip, frames, skipped);
+        double elapsed = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+        _signal = std::move(signal);
+        return elapsed / frames;
+    }
+}
+
+int main() {
+    constexpr size_t FRAMES = 1800;
+    constexpr size_t TIMED_FRAMES = 6000;
+    _signal = MakeSignal();
+
+    bool ok = true;
+    for (unsigned rate : {32768u, 44100u, 48000u}) {
+        size_t skipped = 0;
+        size_t notSkipped = 0;
+        vector<int16_t> expected = Run(rate, false, FRAMES, notSkipped);
+        vector<int16_t> actual = Run(rate, true, FRAMES, skipped);
+
+        size_t mismatch = 0;
+        while (mismatch < std::min(expected.size(), actual.size()) && expected[mismatch] == actual[mismatch]) {
+            ++mismatch;
+        }
+
+        if (expected.size() != actual.size() || mismatch != expected.size()) {
+            std::fprintf(
+                stderr,
+                "FAIL at %uHz: %zu vs %zu samples submitted, first difference at sample %zu\n",
+                rate, expected.size(), actual.size(), mismatch
+            );
+            ok = false;
+        } else if (skipped == 0 || notSkipped != 0) {
+            // If the shortcut was never taken (or was taken when it shouldn't have been), this test proves nothing
+            std::fprintf(stderr, "FAIL at %uHz: %zu frames skipped with skipping on, %zu with it off\n", rate, skipped, notSkipped);
+            ok = false;
+        } else {
+            std::printf(
+                "%uHz: %zu samples identical, %zu of %zu frames skipped\n",
+                rate, actual.size(), skipped, actual.size() / 2
+            );
+        }
+    }
+
+    for (unsigned rate : {32768u, 48000u}) {
+        double full = TimeSilence(rate, false, TIMED_FRAMES);
+        double skipped = TimeSilence(rate, true, TIMED_FRAMES);
+        std::printf("%uHz, silence only: %.2fus/frame resampled, %.2fus/frame skipped\n", rate, full, skipped);
+    }
+
+    return ok ? 0 : 1;
+}
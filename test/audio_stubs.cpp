@@ -0,0 +1,90 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include "audio_stubs.hpp"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstring>
+#include <optional>
+#include <string>
+
+#include <NDS.h>
+#include <SPU.h>
+
+#include "environment.hpp"
+
+namespace test::audio {
+    static std::vector<int16_t> _spuOutput;
+    static size_t _spuRead = 0;
+    static std::vector<int16_t> _submitted;
+}
+
+void test::audio::QueueSpuOutput(const int16_t* frames, size_t count) {
+    if (_spuRead > 0) {
+        // Discard what's already been read, so that the queue doesn't grow without bound
+        _spuOutput.erase(_spuOutput.begin(), _spuOutput.begin() + _spuRead * 2);
+        _spuRead = 0;
+    }
+
+    _spuOutput.insert(_spuOutput.end(), frames, frames + count * 2);
+}
+
+void test::audio::Clear() {
+    _spuOutput.clear();
+    _spuRead = 0;
+    _submitted.clear();
+}
+
+const std::vector<int16_t>& test::audio::Submitted() {
+    return _submitted;
+}
+
+u32 NDS::NumFrames = 0;
+
+int SPU::GetOutputSize() {
+    return static_cast<int>(test::audio::_spuOutput.size() / 2 - test::audio::_spuRead);
+}
+
+int SPU::ReadOutput(s16* data, int samples) {
+    using namespace test::audio;
+    size_t count = std::min(static_cast<size_t>(samples), _spuOutput.size() / 2 - _spuRead);
+    if (count > 0) {
+        std::memcpy(data, &_spuOutput[_spuRead * 2], count * 2 * sizeof(int16_t));
+        _spuRead += count;
+    }
+
+    return static_cast<int>(count);
+}
+
+bool retro::environment(unsigned, void*) noexcept {
+    return false;
+}
+
+size_t retro::audio_sample_batch(const int16_t* data, size_t frames) {
+    test::audio::_submitted.insert(test::audio::_submitted.end(), data, data + frames * 2);
+    return frames;
+}
+
+const std::optional<std::string>& retro::get_save_directory() {
+    static const std::optional<std::string> directory;
+    return directory;
+}
+
+void retro::debug(const char*, ...) noexcept {}
+void retro::info(const char*, ...) noexcept {}
+void retro::warn(const char*, ...) noexcept {}
+void retro::error(const char*, ...) noexcept {}
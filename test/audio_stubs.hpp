@@ -0,0 +1,37 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef MELONDS_DS_TEST_AUDIO_STUBS_HPP
+#define MELONDS_DS_TEST_AUDIO_STUBS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//! Stands in for the SPU and the frontend, so that audio.cpp can be driven without the rest of the core.
+
+namespace test::audio {
+    /// Queues interleaved stereo frames for the stubbed SPU::ReadOutput to hand out.
+    void QueueSpuOutput(const int16_t* frames, size_t count);
+
+    /// Drops any SPU output that hasn't been read yet, and everything submitted to the frontend so far.
+    void Clear();
+
+    /// Everything the core has submitted to the stubbed frontend since the last Clear.
+    const std::vector<int16_t>& Submitted();
+}
+
+#endif //MELONDS_DS_TEST_AUDIO_STUBS_HPP
@@ -0,0 +1,191 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+//! Checks that the core finds the right host descriptor behind libretro-common's own file streams,
+//! in each of the ways the core opens files that it later syncs or maps into memory.
+//! Runs against the real libretro-common VFS, whose buffered streams never set the handle's fd.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <streams/file_stream.h>
+
+#include "environment.hpp"
+#include "retro/vfs.hpp"
+
+using std::string;
+using std::vector;
+
+bool retro::uses_frontend_vfs() noexcept {
+    return false;
+}
+
+namespace {
+    constexpr size_t FILE_SIZE = 64 * 1024;
+    bool _ok = true;
+
+    void Fail(const string& test, const char* what) {
+        std::fprintf(stderr, "FAIL (%s): %s\n", test.c_str(), what);
+        _ok = false;
+    }
+
+    // True if the descriptor refers to the file at the given path, and not to (say) stdin
+    bool IsSameFile(int fd, const string& path) {
+        struct stat byDescriptor {};
+        struct stat byPath {};
+        return fd >= 0
+            && fstat(fd, &byDescriptor) == 0
+            && stat(path.c_str(), &byPath) == 0
+            && byDescriptor.st_dev == byPath.st_dev
+            && byDescriptor.st_ino == byPath.st_ino;
+    }
+
+    vector<uint8_t> Pattern(uint8_t seed) {
+        vector<uint8_t> data(FILE_SIZE);
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = static_cast<uint8_t>(i * 31 + seed);
+        }
+        return data;
+    }
+
+    vector<uint8_t> ReadBack(const string& path) {
+        void* buffer = nullptr;
+        int64_t length = 0;
+        vector<uint8_t> data;
+        if (filestream_read_file(path.c_str(), &buffer, &length) && buffer) {
+            data.assign(static_cast<uint8_t*>(buffer), static_cast<uint8_t*>(buffer) + length);
+        }
+        free(buffer);
+        return data;
+    }
+
+    // How the GBA SRAM writer syncs its temporary file
+    void TestWriteAndSync(const string& path) {
+        const string test = "write, then sync";
+        vector<uint8_t> data = Pattern(1);
+        RFILE* file = filestream_open(path.c_str(), RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+        if (!file) {
+            return Fail(test, "couldn't open the file");
+        }
+
+        filestream_write(file, data.data(), data.size());
+        int fd = retro::file_descriptor(file);
+        if (!IsSameFile(fd, path)) {
+            Fail(test, "the descriptor doesn't refer to the file");
+        }
+
+        filestream_flush(file);
+        if (!retro::sync_file_descriptor(fd)) {
+            Fail(test, "couldn't sync the file");
+        }
+
+        struct stat info {};
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) != data.size()) {
+            Fail(test, "the flushed file isn't the size that was written");
+        }
+
+        filestream_close(file);
+        if (ReadBack(path) != data) {
+            Fail(test, "the file doesn't hold what was written");
+        }
+    }
+
+    // How Platform::OpenFile opens disk images (e.g. SD cards) that it maps into memory
+    void TestUpdateAndMap(const string& path) {
+        const string test = "update in place, then map";
+        RFILE* file = filestream_open(
+            path.c_str(),
+            RETRO_VFS_FILE_ACCESS_READ_WRITE | RETRO_VFS_FILE_ACCESS_UPDATE_EXISTING,
+            RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS
+        );
+        if (!file) {
+            return Fail(test, "couldn't open the file");
+        }
+
+        int fd = retro::file_descriptor(file);
+        int64_t length = filestream_get_size(file);
+        struct stat info {};
+        if (!IsSameFile(fd, path) || fstat(fd, &info) != 0 || info.st_size != length) {
+            filestream_close(file);
+            return Fail(test, "the descriptor doesn't refer to the file");
+        }
+
+        void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            filestream_close(file);
+            return Fail(test, "couldn't map the file");
+        }
+
+        vector<uint8_t> data = Pattern(2);
+        if (std::memcmp(mapped, Pattern(1).data(), length) != 0) {
+            Fail(test, "the mapping doesn't hold the file's contents");
+        }
+
+        std::memcpy(mapped, data.data(), length);
+        msync(mapped, length, MS_SYNC);
+        munmap(mapped, length);
+        if (!retro::sync_file_descriptor(fd)) {
+            Fail(test, "couldn't sync the file");
+        }
+
+        filestream_close(file);
+        if (ReadBack(path) != data) {
+            Fail(test, "writes to the mapping didn't reach the file");
+        }
+    }
+
+    // Read-only, frequently-accessed files may be opened unbuffered, with the handle's fd set instead
+    void TestReadOnly(const string& path) {
+        const string test = "read-only";
+        RFILE* file = filestream_open(path.c_str(), RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS);
+        if (!file) {
+            return Fail(test, "couldn't open the file");
+        }
+
+        if (!IsSameFile(retro::file_descriptor(file), path)) {
+            Fail(test, "the descriptor doesn't refer to the file");
+        }
+
+        filestream_close(file);
+    }
+}
+
+int main(int argc, char** argv) {
+    string directory = argc > 1 ? argv[1] : ".";
+    string path = directory + "/file_descriptor.bin";
+
+    TestWriteAndSync(path);
+    TestUpdateAndMap(path);
+    TestReadOnly(path);
+    filestream_delete(path.c_str());
+
+    if (retro::file_descriptor(nullptr) != -1) {
+        Fail("no file", "a null stream has a descriptor");
+    }
+
+    if (_ok) {
+        std::printf("Descriptors behind libretro-common's streams refer to the right files\n");
+    }
+
+    return _ok ? 0 : 1;
+}
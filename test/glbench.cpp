@@ -0,0 +1,728 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+//! A headless libretro frontend that drives the core's OpenGL renderer on an EGL context
+//! (e.g. Mesa's llvmpipe), so that GL-side changes can be tested and benchmarked without a GPU.
+//! Reports frame times, draw calls per frame, and hashes of the composed frames.
+//! With --check-capture, also checks the core's own video capture against the frames it presented.
+//! Exits with 77 (which CTest treats as a skip) if no suitable EGL context is available.
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <dlfcn.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <libretro.h>
+
+using std::string;
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+// Just enough of OpenGL to give the core a framebuffer and read it back;
+// declared here so that the harness only depends on EGL.
+namespace gl {
+    using GLenum = unsigned int;
+    using GLuint = unsigned int;
+    using GLint = int;
+    using GLsizei = int;
+
+    constexpr GLenum FRAMEBUFFER = 0x8D40;
+    constexpr GLenum READ_FRAMEBUFFER = 0x8CA8;
+    constexpr GLenum RENDERBUFFER = 0x8D41;
+    constexpr GLenum RGBA8 = 0x8058;
+    constexpr GLenum DEPTH24_STENCIL8 = 0x88F0;
+    constexpr GLenum DEPTH_COMPONENT24 = 0x81A6;
+    constexpr GLenum COLOR_ATTACHMENT0 = 0x8CE0;
+    constexpr GLenum DEPTH_ATTACHMENT = 0x8D00;
+    constexpr GLenum DEPTH_STENCIL_ATTACHMENT = 0x821A;
+    constexpr GLenum FRAMEBUFFER_COMPLETE = 0x8CD5;
+    constexpr GLenum RGBA = 0x1908;
+    constexpr GLenum UNSIGNED_BYTE = 0x1401;
+    constexpr GLenum PACK_ALIGNMENT = 0x0D05;
+    constexpr GLenum RENDERER = 0x1F01;
+    constexpr GLenum VERSION = 0x1F02;
+
+    static void (KHRONOS_APIENTRY *GenFramebuffers)(GLsizei, GLuint*);
+    static void (KHRONOS_APIENTRY *DeleteFramebuffers)(GLsizei, const GLuint*);
+    static void (KHRONOS_APIENTRY *BindFramebuffer)(GLenum, GLuint);
+    static GLenum (KHRONOS_APIENTRY *CheckFramebufferStatus)(GLenum);
+    static void (KHRONOS_APIENTRY *GenRenderbuffers)(GLsizei, GLuint*);
+    static void (KHRONOS_APIENTRY *DeleteRenderbuffers)(GLsizei, const GLuint*);
+    static void (KHRONOS_APIENTRY *BindRenderbuffer)(GLenum, GLuint);
+    static void (KHRONOS_APIENTRY *RenderbufferStorage)(GLenum, GLenum, GLsizei, GLsizei);
+    static void (KHRONOS_APIENTRY *FramebufferRenderbuffer)(GLenum, GLenum, GLenum, GLuint);
+    static void (KHRONOS_APIENTRY *PixelStorei)(GLenum, GLint);
+    static void (KHRONOS_APIENTRY *ReadPixels)(GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, void*);
+    static void (KHRONOS_APIENTRY *Finish)();
+    static const unsigned char* (KHRONOS_APIENTRY *GetString)(GLenum);
+
+    // The real draw functions, wrapped so that we can count the core's draw calls
+    static void (KHRONOS_APIENTRY *DrawArrays)(GLenum, GLint, GLsizei);
+    static void (KHRONOS_APIENTRY *DrawElements)(GLenum, GLsizei, GLenum, const void*);
+    static void (KHRONOS_APIENTRY *DrawArraysInstanced)(GLenum, GLint, GLsizei, GLsizei);
+    static void (KHRONOS_APIENTRY *DrawElementsInstanced)(GLenum, GLsizei, GLenum, const void*, GLsizei);
+    static void (KHRONOS_APIENTRY *DrawRangeElements)(GLenum, GLuint, GLuint, GLsizei, GLenum, const void*);
+}
+
+// The libretro API as exported by the core
+struct Core {
+    void* handle;
+    void (*set_environment)(retro_environment_t);
+    void (*set_video_refresh)(retro_video_refresh_t);
+    void (*set_audio_sample)(retro_audio_sample_t);
+    void (*set_audio_sample_batch)(retro_audio_sample_batch_t);
+    void (*set_input_poll)(retro_input_poll_t);
+    void (*set_input_state)(retro_input_state_t);
+    void (*init)();
+    void (*deinit)();
+    void (*get_system_info)(retro_system_info*);
+    void (*get_system_av_info)(retro_system_av_info*);
+    bool (*load_game)(const retro_game_info*);
+    void (*unload_game)();
+    void (*run)();
+};
+
+struct Options {
+    string corePath;
+    string romPath;
+    string systemDir = ".";
+    string saveDir = ".";
+    unsigned frames = 600;
+    unsigned hashInterval = 60;
+    string expectedHash;
+    bool checkCapture = false;
+    bool verbose = false;
+    std::map<string, string> variables { {"melonds_render_mode", "opengl"} };
+};
+
+static Options options;
+static retro_hw_render_callback hwRender {};
+static bool hwRenderRequested = false;
+static bool shutdownRequested = false;
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static EGLSurface surface = EGL_NO_SURFACE;
+static gl::GLuint framebuffer = 0;
+static gl::GLuint colorbuffer = 0;
+static gl::GLuint depthbuffer = 0;
+
+// Per-run counters
+static uint64_t drawCalls = 0;
+static unsigned frameIndex = 0;
+static uint64_t lastHash = 0;
+static bool frameHashed = false;
+static Clock::duration readbackTime {};
+static vector<uint8_t> pixels;
+
+// Per-session counters, for checking the core's video capture
+static unsigned presentedFrames = 0;
+static vector<uint64_t> presentedHashes;
+
+static void KHRONOS_APIENTRY CountDrawArrays(gl::GLenum mode, gl::GLint first, gl::GLsizei count) {
+    ++drawCalls;
+    gl::DrawArrays(mode, first, count);
+}
+
+static void KHRONOS_APIENTRY CountDrawElements(gl::GLenum mode, gl::GLsizei count, gl::GLenum type, const void* indices) {
+    ++drawCalls;
+    gl::DrawElements(mode, count, type, indices);
+}
+
+static void KHRONOS_APIENTRY CountDrawArraysInstanced(gl::GLenum mode, gl::GLint first, gl::GLsizei count, gl::GLsizei instances) {
+    ++drawCalls;
+    gl::DrawArraysInstanced(mode, first, count, instances);
+}
+
+static void KHRONOS_APIENTRY CountDrawElementsInstanced(gl::GLenum mode, gl::GLsizei count, gl::GLenum type, const void* indices, gl::GLsizei instances) {
+    ++drawCalls;
+    gl::DrawElementsInstanced(mode, count, type, indices, instances);
+}
+
+static void KHRONOS_APIENTRY CountDrawRangeElements(gl::GLenum mode, gl::GLuint start, gl::GLuint end, gl::GLsizei count, gl::GLenum type, const void* indices) {
+    ++drawCalls;
+    gl::DrawRangeElements(mode, start, end, count, type, indices);
+}
+
+template<typename T>
+static bool Load(T& function, const char* name) {
+    function = reinterpret_cast<T>(eglGetProcAddress(name));
+    if (!function) {
+        fprintf(stderr, "Failed to load %s\n", name);
+    }
+    return function != nullptr;
+}
+
+// Hands out the real GL functions, except for the draw calls, which are counted first
+static retro_proc_address_t GetProcAddress(const char* name) {
+    static const std::map<string, retro_proc_address_t> wrappers {
+        {"glDrawArrays", reinterpret_cast<retro_proc_address_t>(CountDrawArrays)},
+        {"glDrawElements", reinterpret_cast<retro_proc_address_t>(CountDrawElements)},
+        {"glDrawArraysInstanced", reinterpret_cast<retro_proc_address_t>(CountDrawArraysInstanced)},
+        {"glDrawElementsInstanced", reinterpret_cast<retro_proc_address_t>(CountDrawElementsInstanced)},
+        {"glDrawRangeElements", reinterpret_cast<retro_proc_address_t>(CountDrawRangeElements)},
+    };
+
+    if (auto wrapper = wrappers.find(name); wrapper != wrappers.end()) {
+        return wrapper->second;
+    }
+
+    return reinterpret_cast<retro_proc_address_t>(eglGetProcAddress(name));
+}
+
+static uintptr_t GetCurrentFramebuffer() {
+    return framebuffer;
+}
+
+// 64-bit FNV-1a; it only needs to tell frames apart, not resist collisions
+static uint64_t Hash(const uint8_t* data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static bool ShouldHash() {
+    return options.hashInterval > 0 && ((frameIndex + 1) % options.hashInterval == 0 || frameIndex + 1 == options.frames);
+}
+
+static void VideoRefresh(const void* data, unsigned width, unsigned height, size_t pitch) {
+    if (data) {
+        ++presentedFrames;
+    }
+
+    if (!data || !ShouldHash()) {
+        // If the core duped this frame, or we're not checking it...
+        return;
+    }
+
+    Clock::time_point start = Clock::now();
+    if (data == RETRO_HW_FRAME_BUFFER_VALID) {
+        pixels.resize(static_cast<size_t>(width) * height * 4);
+        gl::BindFramebuffer(gl::READ_FRAMEBUFFER, framebuffer);
+        gl::PixelStorei(gl::PACK_ALIGNMENT, 1);
+        gl::ReadPixels(0, 0, width, height, gl::RGBA, gl::UNSIGNED_BYTE, pixels.data());
+        lastHash = Hash(pixels.data(), pixels.size());
+    } else {
+        // If the core fell back to the software renderer...
+        pixels.clear();
+        const uint8_t* rows = static_cast<const uint8_t*>(data);
+        for (unsigned y = 0; y < height; ++y) {
+            pixels.insert(pixels.end(), rows + y * pitch, rows + y * pitch + width * 4);
+        }
+        lastHash = Hash(pixels.data(), pixels.size());
+    }
+    presentedHashes.push_back(lastHash);
+    frameHashed = true;
+    readbackTime += Clock::now() - start;
+}
+
+static void AudioSample(int16_t, int16_t) {
+}
+
+static size_t AudioSampleBatch(const int16_t*, size_t frames) {
+    return frames;
+}
+
+static void InputPoll() {
+}
+
+static int16_t InputState(unsigned, unsigned, unsigned, unsigned) {
+    return 0;
+}
+
+static void Log(retro_log_level level, const char* fmt, ...) {
+    if (level < RETRO_LOG_WARN && !options.verbose) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+static bool Environment(unsigned cmd, void* data) {
+    switch (cmd & ~RETRO_ENVIRONMENT_EXPERIMENTAL) {
+        case RETRO_ENVIRONMENT_SET_HW_RENDER: {
+            auto* callback = static_cast<retro_hw_render_callback*>(data);
+            if (callback->context_type != RETRO_HW_CONTEXT_OPENGL_CORE && callback->context_type != RETRO_HW_CONTEXT_OPENGL) {
+                return false;
+            }
+            callback->get_current_framebuffer = GetCurrentFramebuffer;
+            callback->get_proc_address = GetProcAddress;
+            hwRender = *callback;
+            hwRenderRequested = true;
+            return true;
+        }
+        case RETRO_ENVIRONMENT_GET_PREFERRED_HW_RENDER:
+            *static_cast<unsigned*>(data) = RETRO_HW_CONTEXT_OPENGL_CORE;
+            return true;
+        case RETRO_ENVIRONMENT_GET_VARIABLE: {
+            auto* variable = static_cast<retro_variable*>(data);
+            auto value = options.variables.find(variable->key);
+            if (value == options.variables.end()) {
+                return false;
+            }
+            variable->value = value->second.c_str();
+            return true;
+        }
+        case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+            *static_cast<bool*>(data) = false;
+            return true;
+        case RETRO_ENVIRONMENT_SET_VARIABLES:
+        case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+        case RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME:
+            return true;
+        case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
+            *static_cast<const char**>(data) = options.systemDir.c_str();
+            return true;
+        case RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY:
+            *static_cast<const char**>(data) = options.saveDir.c_str();
+            return true;
+        case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+            static_cast<retro_log_callback*>(data)->log = Log;
+            return true;
+        case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE:
+            *static_cast<int*>(data) = 3; // Audio and video
+            return true;
+        case RETRO_ENVIRONMENT_SHUTDOWN:
+            shutdownRequested = true;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool LoadCore(Core& core, const char* path) {
+    core.handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!core.handle) {
+        fprintf(stderr, "Failed to load core \"%s\": %s\n", path, dlerror());
+        return false;
+    }
+
+    bool ok = true;
+    auto load = [&](auto& function, const char* name) {
+        function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(dlsym(core.handle, name));
+        if (!function) {
+            fprintf(stderr, "Core is missing %s\n", name);
+            ok = false;
+        }
+    };
+    load(core.set_environment, "retro_set_environment");
+    load(core.set_video_refresh, "retro_set_video_refresh");
+    load(core.set_audio_sample, "retro_set_audio_sample");
+    load(core.set_audio_sample_batch, "retro_set_audio_sample_batch");
+    load(core.set_input_poll, "retro_set_input_poll");
+    load(core.set_input_state, "retro_set_input_state");
+    load(core.init, "retro_init");
+    load(core.deinit, "retro_deinit");
+    load(core.get_system_info, "retro_get_system_info");
+    load(core.get_system_av_info, "retro_get_system_av_info");
+    load(core.load_game, "retro_load_game");
+    load(core.unload_game, "retro_unload_game");
+    load(core.run, "retro_run");
+    return ok;
+}
+
+// Creates an OpenGL 3.3 core context, preferring Mesa's surfaceless platform so that no display server is needed
+static bool CreateContext() {
+    auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    bool surfaceless = getPlatformDisplay && clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless");
+    display = surfaceless ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr) : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        fprintf(stderr, "No EGL display is available\n");
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "EGL %d.%d doesn't support desktop OpenGL\n", major, minor);
+        return false;
+    }
+
+    const EGLint configAttributes[] {
+        EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+        fprintf(stderr, "No suitable EGL config is available\n");
+        return false;
+    }
+
+    const EGLint contextAttributes[] {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Failed to create an OpenGL 3.3 core context\n");
+        return false;
+    }
+
+    if (!surfaceless) {
+        const EGLint surfaceAttributes[] { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+    }
+
+    if (!eglMakeCurrent(display, surface, surface, context)) {
+        fprintf(stderr, "Failed to make the OpenGL context current\n");
+        return false;
+    }
+
+    bool ok = Load(gl::GenFramebuffers, "glGenFramebuffers")
+        && Load(gl::DeleteFramebuffers, "glDeleteFramebuffers")
+        && Load(gl::BindFramebuffer, "glBindFramebuffer")
+        && Load(gl::CheckFramebufferStatus, "glCheckFramebufferStatus")
+        && Load(gl::GenRenderbuffers, "glGenRenderbuffers")
+        && Load(gl::DeleteRenderbuffers, "glDeleteRenderbuffers")
+        && Load(gl::BindRenderbuffer, "glBindRenderbuffer")
+        && Load(gl::RenderbufferStorage, "glRenderbufferStorage")
+        && Load(gl::FramebufferRenderbuffer, "glFramebufferRenderbuffer")
+        && Load(gl::PixelStorei, "glPixelStorei")
+        && Load(gl::ReadPixels, "glReadPixels")
+        && Load(gl::Finish, "glFinish")
+        && Load(gl::GetString, "glGetString")
+        && Load(gl::DrawArrays, "glDrawArrays")
+        && Load(gl::DrawElements, "glDrawElements")
+        && Load(gl::DrawArraysInstanced, "glDrawArraysInstanced")
+        && Load(gl::DrawElementsInstanced, "glDrawElementsInstanced")
+        && Load(gl::DrawRangeElements, "glDrawRangeElements");
+
+    if (ok) {
+        printf("GL renderer: %s (%s)\n", gl::GetString(gl::RENDERER), gl::GetString(gl::VERSION));
+    }
+    return ok;
+}
+
+// The framebuffer that the core renders into, sized for the largest frame it may produce
+static bool CreateFramebuffer(unsigned width, unsigned height) {
+    gl::GenFramebuffers(1, &framebuffer);
+    gl::BindFramebuffer(gl::FRAMEBUFFER, framebuffer);
+
+    gl::GenRenderbuffers(1, &colorbuffer);
+    gl::BindRenderbuffer(gl::RENDERBUFFER, colorbuffer);
+    gl::RenderbufferStorage(gl::RENDERBUFFER, gl::RGBA8, width, height);
+    gl::FramebufferRenderbuffer(gl::FRAMEBUFFER, gl::COLOR_ATTACHMENT0, gl::RENDERBUFFER, colorbuffer);
+
+    if (hwRender.depth) {
+        gl::GenRenderbuffers(1, &depthbuffer);
+        gl::BindRenderbuffer(gl::RENDERBUFFER, depthbuffer);
+        gl::RenderbufferStorage(gl::RENDERBUFFER, hwRender.stencil ? gl::DEPTH24_STENCIL8 : gl::DEPTH_COMPONENT24, width, height);
+        gl::FramebufferRenderbuffer(gl::FRAMEBUFFER, hwRender.stencil ? gl::DEPTH_STENCIL_ATTACHMENT : gl::DEPTH_ATTACHMENT, gl::RENDERBUFFER, depthbuffer);
+    }
+
+    bool complete = gl::CheckFramebufferStatus(gl::FRAMEBUFFER) == gl::FRAMEBUFFER_COMPLETE;
+    gl::BindRenderbuffer(gl::RENDERBUFFER, 0);
+    gl::BindFramebuffer(gl::FRAMEBUFFER, 0);
+    if (!complete) {
+        fprintf(stderr, "The %ux%u framebuffer is incomplete\n", width, height);
+    }
+    return complete;
+}
+
+static void DestroyContext() {
+    if (framebuffer) {
+        gl::DeleteFramebuffers(1, &framebuffer);
+        gl::DeleteRenderbuffers(1, &colorbuffer);
+        if (depthbuffer) {
+            gl::DeleteRenderbuffers(1, &depthbuffer);
+        }
+    }
+
+    if (display != EGL_NO_DISPLAY) {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (surface != EGL_NO_SURFACE) {
+            eglDestroySurface(display, surface);
+        }
+        if (context != EGL_NO_CONTEXT) {
+            eglDestroyContext(display, context);
+        }
+        eglTerminate(display);
+    }
+}
+
+// Matches melonds::render::CaptureHeader and CaptureRecord
+struct CaptureHeader {
+    char magic[4];
+    uint32_t version;
+};
+
+struct CaptureRecord {
+    uint32_t frame;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+};
+
+// Checks that the core captured every frame it presented, in order,
+// and that the frames we hashed are byte-for-byte the ones it captured
+static bool CheckCapture() {
+    string path = options.saveDir + "/melonDS DS video capture.bin";
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "Failed to open \"%s\"; is the core a debug build?\n", path.c_str());
+        return false;
+    }
+
+    CaptureHeader header {};
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, "MDSV", 4) != 0 || header.version != 1) {
+        fprintf(stderr, "\"%s\" isn't a version 1 video capture\n", path.c_str());
+        return false;
+    }
+
+    vector<uint64_t> capturedHashes;
+    vector<uint8_t> frame;
+    uint32_t lastFrame = 0;
+    CaptureRecord record {};
+    while (file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        frame.resize(static_cast<size_t>(record.width) * record.height * 4);
+        if (!file.read(reinterpret_cast<char*>(frame.data()), frame.size())) {
+            fprintf(stderr, "Capture is truncated after %zu frames\n", capturedHashes.size());
+            return false;
+        }
+
+        if (!capturedHashes.empty() && record.frame <= lastFrame) {
+            fprintf(stderr, "Captured frame %u follows frame %u\n", record.frame, lastFrame);
+            return false;
+        }
+
+        lastFrame = record.frame;
+        capturedHashes.push_back(Hash(frame.data(), frame.size()));
+    }
+
+    printf("captured frames: %zu\n", capturedHashes.size());
+    if (capturedHashes.size() != presentedFrames) {
+        fprintf(stderr, "Core presented %u frames, but captured %zu\n", presentedFrames, capturedHashes.size());
+        return false;
+    }
+
+    // Both lists are in presentation order, so each hashed frame must turn up after the previous one
+    auto next = capturedHashes.begin();
+    for (uint64_t hash : presentedHashes) {
+        next = std::find(next, capturedHashes.end(), hash);
+        if (next == capturedHashes.end()) {
+            fprintf(stderr, "Presented frame with hash %016" PRIx64 " isn't in the capture\n", hash);
+            return false;
+        }
+        ++next;
+    }
+
+    return true;
+}
+
+static void PrintUsage(const char* argv0) {
+    fprintf(stderr,
+        "Usage: %s --core <path> [options] <rom>\n"
+        "  --frames <n>          Frames to run (default 600)\n"
+        "  --hash-interval <n>   Read back and hash every nth frame and the last one; 0 disables (default 60)\n"
+        "  --expect <hash>       Fail unless the last frame's hash matches\n"
+        "  --system-dir <path>   Directory the core looks for BIOS and firmware in (default .)\n"
+        "  --save-dir <path>     Directory the core writes saves to (default .)\n"
+        "  --option <key=value>  Sets a core option; may be repeated\n"
+        "  --check-capture       Enable the core's video capture (debug builds only) and check it against the presented frames\n"
+        "  --verbose             Show the core's debug and info logs\n",
+        argv0
+    );
+}
+
+static bool ParseArguments(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        auto next = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* value = nullptr;
+
+        if (arg == "--verbose") {
+            options.verbose = true;
+        } else if (arg == "--check-capture") {
+            options.checkCapture = true;
+            options.variables["melonds_video_capture"] = "enabled";
+        } else if (arg[0] != '-') {
+            options.romPath = arg;
+        } else if (!(value = next())) {
+            fprintf(stderr, "%s needs a value\n", arg.c_str());
+            return false;
+        } else if (arg == "--core") {
+            options.corePath = value;
+        } else if (arg == "--frames") {
+            options.frames = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--hash-interval") {
+            options.hashInterval = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--expect") {
+            options.expectedHash = value;
+        } else if (arg == "--system-dir") {
+            options.systemDir = value;
+        } else if (arg == "--save-dir") {
+            options.saveDir = value;
+        } else if (arg == "--option") {
+            const char* equals = strchr(value, '=');
+            if (!equals) {
+                fprintf(stderr, "--option needs a key=value pair, got \"%s\"\n", value);
+                return false;
+            }
+            options.variables[string(value, equals)] = equals + 1;
+        } else {
+            fprintf(stderr, "Unknown argument \"%s\"\n", arg.c_str());
+            return false;
+        }
+    }
+
+    return !options.corePath.empty() && !options.romPath.empty() && options.frames > 0;
+}
+
+int main(int argc, char** argv) {
+    if (!ParseArguments(argc, argv)) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    if (!CreateContext()) {
+        DestroyContext();
+        return 77;
+    }
+
+    Core core {};
+    if (!LoadCore(core, options.corePath.c_str())) {
+        DestroyContext();
+        return 1;
+    }
+
+    std::ifstream romFile(options.romPath, std::ios::binary);
+    vector<char> rom((std::istreambuf_iterator<char>(romFile)), std::istreambuf_iterator<char>());
+    if (rom.empty()) {
+        fprintf(stderr, "Failed to read ROM \"%s\"\n", options.romPath.c_str());
+        DestroyContext();
+        return 1;
+    }
+
+    core.set_environment(Environment);
+    core.set_video_refresh(VideoRefresh);
+    core.set_audio_sample(AudioSample);
+    core.set_audio_sample_batch(AudioSampleBatch);
+    core.set_input_poll(InputPoll);
+    core.set_input_state(InputState);
+    core.init();
+
+    retro_game_info game { options.romPath.c_str(), rom.data(), rom.size(), nullptr };
+    if (!core.load_game(&game)) {
+        fprintf(stderr, "Core failed to load \"%s\"\n", options.romPath.c_str());
+        core.deinit();
+        DestroyContext();
+        return 1;
+    }
+
+    if (!hwRenderRequested) {
+        fprintf(stderr, "Core didn't request an OpenGL context; is it built with OpenGL support?\n");
+        core.unload_game();
+        core.deinit();
+        DestroyContext();
+        return 77;
+    }
+
+    retro_system_av_info av {};
+    core.get_system_av_info(&av);
+    if (!CreateFramebuffer(av.geometry.max_width, av.geometry.max_height)) {
+        core.unload_game();
+        core.deinit();
+        DestroyContext();
+        return 1;
+    }
+    hwRender.context_reset();
+
+    vector<double> frameTimes;
+    frameTimes.reserve(options.frames);
+    uint64_t totalDrawCalls = 0;
+    for (frameIndex = 0; frameIndex < options.frames && !shutdownRequested; ++frameIndex) {
+        drawCalls = 0;
+        frameHashed = false;
+        readbackTime = {};
+
+        Clock::time_point start = Clock::now();
+        core.run();
+        gl::Finish(); // Count the GPU's work (llvmpipe's, really) towards the frame that issued it
+        Clock::duration elapsed = Clock::now() - start - readbackTime;
+
+        frameTimes.push_back(std::chrono::duration<double, std::milli>(elapsed).count());
+        totalDrawCalls += drawCalls;
+        if (frameHashed) {
+            printf("frame %u: %" PRIu64 " draw calls, hash %016" PRIx64 "\n", frameIndex, drawCalls, lastHash);
+        }
+    }
+
+    if (hwRender.context_destroy) {
+        hwRender.context_destroy();
+    }
+    core.unload_game();
+    core.deinit();
+    DestroyContext();
+    dlclose(core.handle);
+
+    if (frameTimes.empty()) {
+        fprintf(stderr, "The core shut down before running any frames\n");
+        return 1;
+    }
+
+    double total = 0;
+    for (double time : frameTimes) {
+        total += time;
+    }
+    vector<double> sorted = frameTimes;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double p) { return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))]; };
+
+    printf("frames: %zu\n", frameTimes.size());
+    printf("frame time (ms): mean %.3f, median %.3f, p95 %.3f, max %.3f\n", total / frameTimes.size(), percentile(0.5), percentile(0.95), sorted.back());
+    printf("draw calls per frame: %.2f\n", static_cast<double>(totalDrawCalls) / frameTimes.size());
+
+    if (!options.expectedHash.empty()) {
+        char actual[17];
+        snprintf(actual, sizeof(actual), "%016" PRIx64, lastHash);
+        if (options.expectedHash != actual) {
+            fprintf(stderr, "Last frame's hash is %s, expected %s\n", actual, options.expectedHash.c_str());
+            return 1;
+        }
+    }
+
+    if (options.checkCapture && !CheckCapture()) {
+        return 1;
+    }
+
+    return shutdownRequested ? 1 : 0;
+}
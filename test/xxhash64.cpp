@@ -0,0 +1,121 @@
+/*
+    Copyright 2023 Jesse Talavera-Greenberg
+
+    melonDS DS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS DS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS DS. If not, see http://www.gnu.org/licenses/.
+*/
+
+//! Checks the core's XXH64 against the reference implementation's output,
+//! so that state hashes traced by the core can be compared with those from other tools.
+//! The expected values were produced by the reference xxHash library.
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#include "xxhash64.hpp"
+
+namespace {
+    constexpr uint64_t SEED = 0x9E3779B185EBCA87ULL;
+
+    struct StringVector {
+        const char* Input;
+        uint64_t Hash;
+    };
+
+    struct LengthVector {
+        size_t Length;
+        uint64_t Hash;
+        uint64_t SeededHash;
+    };
+
+    constexpr StringVector STRINGS[] = {
+        {"", 0xEF46DB3751D8E999ULL},
+        {"a", 0xD24EC4F1A98C6E5BULL},
+        {"abc", 0x44BC2CF5AD770999ULL},
+        {"message digest", 0x066ED728FCEEB3BEULL},
+        {"abcdefghijklmnopqrstuvwxyz", 0xCFE1F278FA89835CULL},
+        {"The quick brown fox jumps over the lazy dog", 0x0B242D361FDA71BCULL},
+    };
+
+    // Lengths on either side of each of the hash's block sizes (4, 8, and 32 bytes)
+    constexpr LengthVector LENGTHS[] = {
+        {0, 0xEF46DB3751D8E999ULL, 0x6EC6D05F61C7E7A7ULL},
+        {1, 0xE934A84ADB052768ULL, 0x60508B0CED72C717ULL},
+        {3, 0xFF7E1959CB50794AULL, 0xB7C97337300AA844ULL},
+        {4, 0x9136A0DCA57457EEULL, 0x05C571D4638902D1ULL},
+        {7, 0x6C83909A9F01ED25ULL, 0x88566A55A29C05F5ULL},
+        {8, 0xCDBCF538E71D1348ULL, 0xC9BAE69468995DD2ULL},
+        {12, 0x0723BF50086EAD9AULL, 0x86966626B6D03591ULL},
+        {31, 0x299B39A290E6D783ULL, 0xD5B2DBBFA83B0B60ULL},
+        {32, 0x18B216492BB44B70ULL, 0xAAFEF1645D1B13D9ULL},
+        {33, 0x55C8DC3E578F5B59ULL, 0x07493C92A23A6825ULL},
+        {63, 0xA9EFBE0FA0F3F4E7ULL, 0x626845AEEA2BFC12ULL},
+        {64, 0xEF558F8ACAC2B5CDULL, 0x97973ADE8B590FE4ULL},
+        {100, 0x4BFE019CD91D9EA4ULL, 0xC14DD279D7809C6AULL},
+        {255, 0xA80F35BB0DC8E3A7ULL, 0xF7EA3B5298F09A46ULL},
+    };
+
+    // Pseudo-random bytes, so that every byte of the input matters
+    std::vector<uint8_t> MakeBuffer(size_t size) {
+        std::vector<uint8_t> buffer(size);
+        uint64_t state = 2654435761ULL;
+        for (uint8_t& byte : buffer) {
+            byte = static_cast<uint8_t>(state >> 56);
+            state *= 11400714785074694797ULL;
+        }
+
+        return buffer;
+    }
+
+    bool Check(const char* name, uint64_t actual, uint64_t expected) {
+        if (actual != expected) {
+            std::fprintf(stderr, "FAIL: %s hashed to %016" PRIx64 ", expected %016" PRIx64 "\n", name, actual, expected);
+            return false;
+        }
+
+        return true;
+    }
+}
+
+int main() {
+    bool ok = true;
+    for (const StringVector& vector : STRINGS) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "\"%.48s\"", vector.Input);
+        ok &= Check(name, melonds::XXHash64(vector.Input, std::strlen(vector.Input)), vector.Hash);
+    }
+
+    std::vector<uint8_t> buffer = MakeBuffer(256);
+    for (const LengthVector& vector : LENGTHS) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%zu bytes", vector.Length);
+        ok &= Check(name, melonds::XXHash64(buffer.data(), vector.Length), vector.Hash);
+
+        std::snprintf(name, sizeof(name), "%zu bytes (seeded)", vector.Length);
+        ok &= Check(name, melonds::XXHash64(buffer.data(), vector.Length, SEED), vector.SeededHash);
+    }
+
+    // The lanes read unaligned data
+    std::vector<uint8_t> unaligned(buffer.size() + 1);
+    std::memcpy(unaligned.data() + 1, buffer.data(), buffer.size());
+    ok &= Check("100 unaligned bytes", melonds::XXHash64(unaligned.data() + 1, 100), 0x4BFE019CD91D9EA4ULL);
+
+    if (ok) {
+        std::printf("%zu XXH64 vectors match\n", std::size(STRINGS) + 2 * std::size(LENGTHS) + 1);
+    }
+
+    return ok ? 0 : 1;
+}